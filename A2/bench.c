@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* User defined headers */
+#include "evlog.h"
+
+/* User defines */
+#define LINE_LENGTH 256
+#define MAX_VALUES 64
+#define MAX_ARGS 64
+#define LOG_ID "1"
+
+/* User typedefs */
+typedef struct latency {
+    double mean, p50, p90, p99, max;
+} latency;
+
+typedef struct result {
+    int queue_size;
+    double elapsed;
+    double tps;
+    latency wait;
+    latency response;
+} result;
+
+/* Private function prototypes */
+static int split_list(char *list, char **values);
+static void run_once(char **extra, int nextra, char *threads, char *size, char *queue,
+    char *wait, result *r);
+static void parse_log(const char *path, result *r);
+static void print_result(int index, char *threads, char *queue, char *wait, int run,
+    result *r);
+
+/* Private global variables */
+static char prodcon[PATH_MAX];
+static char workdir[] = "/tmp/prodcon-bench.XXXXXX";
+static int trace_fd;
+enum format {Csv_Format, Json_Format};
+static enum format format = Csv_Format;
+
+
+/*
+* Main program
+*
+* Runs prodcon on a trace for every combination of thread count, queue size,
+* queue type and wait policy, repeating each run, and prints one row of
+* throughput and latency per run as CSV or JSON. Any arguments after the trace
+* are passed to every prodcon run.
+*/
+int main(int argc, char *argv[]) {
+  char *thread_list = "1,2,4";
+  char *size_list = "0";
+  char *queue_list = "mutex";
+  char *wait_list = "park";
+  char *path = "./prodcon";
+  int repeats = 3;
+  int opt;
+  // Stop at the trace so the options that follow it reach prodcon
+  while((opt = getopt(argc, argv, "+t:s:q:w:r:o:x:")) != -1) {
+    switch(opt) {
+    case 't':
+      thread_list = optarg;
+      break;
+    case 's':
+      size_list = optarg;
+      break;
+    case 'q':
+      queue_list = optarg;
+      break;
+    case 'w':
+      wait_list = optarg;
+      break;
+    case 'r':
+      if((repeats = atoi(optarg)) < 1) {
+        printf("Error: Invalid repeat count provided\n");
+        exit(1);
+      }
+      break;
+    case 'o':
+      if(strcmp(optarg, "csv") == 0) {
+        format = Csv_Format;
+      } else if(strcmp(optarg, "json") == 0) {
+        format = Json_Format;
+      } else {
+        printf("Error: Invalid output format provided\n");
+        exit(1);
+      }
+      break;
+    case 'x':
+      path = optarg;
+      break;
+    default:
+      printf("Usage: prodcon-bench [-t threads,...] [-s size,...] [-q queue,...] [-w wait,...] [-r repeats] [-o csv|json] [-x prodcon] trace [prodcon options]\n");
+      exit(1);
+    }
+  }
+  if(optind >= argc) {
+    printf("Error: Not enough command line arguments\n");
+    exit(1);
+  }
+  for(int i=optind+1; i<argc; i++) {
+    // Results are read back from the text log
+    if((strcmp(argv[i], "-l") == 0 && i + 1 < argc && strcmp(argv[i+1], "binary") == 0) ||
+        strcmp(argv[i], "-lbinary") == 0) {
+      printf("Error: prodcon-bench needs a text log, not -l binary\n");
+      exit(1);
+    }
+  }
+  if(realpath(path, prodcon) == NULL) {
+    perror("Could not find prodcon");
+    exit(1);
+  }
+  if((trace_fd = open(argv[optind], O_RDONLY)) < 0) {
+    perror("Could not open trace");
+    exit(1);
+  }
+  if(mkdtemp(workdir) == NULL) {
+    perror("Could not create working directory");
+    exit(1);
+  }
+
+  char *threads[MAX_VALUES], *sizes[MAX_VALUES], *queues[MAX_VALUES], *waits[MAX_VALUES];
+  int nthreads = split_list(thread_list, threads);
+  int nsizes = split_list(size_list, sizes);
+  int nqueues = split_list(queue_list, queues);
+  int nwaits = split_list(wait_list, waits);
+  int index = 0;
+  if(format == Csv_Format) {
+    printf("threads,queue_size,queue,wait,run,elapsed_s,tps,"
+        "wait_mean_ms,wait_p50_ms,wait_p90_ms,wait_p99_ms,wait_max_ms,"
+        "response_mean_ms,response_p50_ms,response_p90_ms,response_p99_ms,response_max_ms\n");
+  } else {
+    printf("[");
+  }
+  for(int t=0; t<nthreads; t++) {
+    for(int s=0; s<nsizes; s++) {
+      for(int q=0; q<nqueues; q++) {
+        for(int w=0; w<nwaits; w++) {
+          for(int run=1; run<=repeats; run++) {
+            result r;
+            run_once(&argv[optind + 1], argc - optind - 1, threads[t], sizes[s],
+                queues[q], waits[w], &r);
+            print_result(index++, threads[t], queues[q], waits[w], run, &r);
+          }
+        }
+      }
+    }
+  }
+  if(format == Json_Format) {
+    printf("\n]\n");
+  }
+
+  close(trace_fd);
+  if(rmdir(workdir) != 0) {
+    perror("Could not remove working directory");
+    exit(1);
+  }
+  return 0;
+}
+
+
+/*
+* Split list
+*
+* Splits a copy of a comma separated list and returns the number of values
+*/
+int split_list(char *list, char **values) {
+  int n = 0;
+  char *copy = strdup(list);
+  for(char *v = strtok(copy, ","); v != NULL && n < MAX_VALUES; v = strtok(NULL, ",")) {
+    values[n++] = v;
+  }
+  if(n == 0) {
+    printf("Error: Empty list provided\n");
+    exit(1);
+  }
+  return n;
+}
+
+
+/*
+* Run once
+*
+* Runs prodcon in the working directory with the trace on stdin and its output
+* sent to stderr, then reads the results back from its log. A queue size of 0
+* leaves prodcon's default.
+*/
+void run_once(char **extra, int nextra, char *threads, char *size, char *queue,
+    char *wait, result *r) {
+  char *args[MAX_ARGS];
+  int n = 0;
+  args[n++] = prodcon;
+  args[n++] = "-q";
+  args[n++] = queue;
+  args[n++] = "-w";
+  args[n++] = wait;
+  if(atoi(size) > 0) {
+    args[n++] = "-s";
+    args[n++] = size;
+  }
+  for(int i=0; i<nextra && n < MAX_ARGS - 3; i++) {
+    args[n++] = extra[i];
+  }
+  args[n++] = threads;
+  args[n++] = LOG_ID;
+  args[n] = NULL;
+
+  if(lseek(trace_fd, 0, SEEK_SET) < 0) {
+    perror("Trace seek failed");
+    exit(1);
+  }
+  int64_t begin = evlog_now();
+  pid_t pid = fork();
+  if(pid < 0) {
+    perror("Fork failed");
+    exit(1);
+  }
+  if(pid == 0) {
+    if(chdir(workdir) != 0 || dup2(trace_fd, STDIN_FILENO) < 0 ||
+        dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+      perror("Could not set up prodcon");
+      exit(1);
+    }
+    execv(prodcon, args);
+    perror("Exec failed");
+    exit(1);
+  }
+  int status;
+  if(waitpid(pid, &status, 0) < 0) {
+    perror("Wait failed");
+    exit(1);
+  }
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("Error: prodcon failed with %s threads\n", threads);
+    exit(1);
+  }
+  memset(r, 0, sizeof(result));
+  r->elapsed = (evlog_now() - begin) / 1000000000.0;
+  char log[PATH_MAX];
+  snprintf(log, sizeof(log), "%s/prodcon.%s.log", workdir, LOG_ID);
+  parse_log(log, r);
+  unlink(log);
+}
+
+
+/*
+* Parse log
+*
+* Reads the throughput, the queue size and the overall rows of the queue wait
+* and response time tables from a prodcon summary. A pipeline has no single
+* queue, so its size is left at 0.
+*/
+void parse_log(const char *path, result *r) {
+  FILE *fd = fopen(path, "r");
+  if(fd == NULL) {
+    perror("Could not open prodcon log");
+    exit(1);
+  }
+  char line[LINE_LENGTH];
+  latency *table = NULL;
+  bool depth = false;
+  while(fgets(line, LINE_LENGTH, fd) != NULL) {
+    if(sscanf(line, "Transactions per second: %lf", &r->tps) == 1) {
+      continue;
+    }
+    if(strncmp(line, "Queue wait (ms):", 16) == 0) {
+      table = &r->wait;
+    } else if(strncmp(line, "Response time (ms):", 19) == 0) {
+      table = &r->response;
+    } else if(strncmp(line, "Queue depth:", 12) == 0) {
+      depth = true;
+    } else if(line[0] != ' ') {
+      table = NULL;
+      depth = false;
+    } else if(depth) {
+      sscanf(line, "    Size %d", &r->queue_size);
+    } else if(table != NULL) {
+      sscanf(line, "    All %lf %lf %lf %lf %lf", &table->mean, &table->p50, &table->p90,
+          &table->p99, &table->max);
+    }
+  }
+  fclose(fd);
+}
+
+
+/*
+* Print result
+*
+* Print one run as a CSV row or JSON object
+*/
+void print_result(int index, char *threads, char *queue, char *wait, int run,
+    result *r) {
+  int queue_size = r->queue_size;
+  if(format == Csv_Format) {
+    printf("%s,%d,%s,%s,%d,%.3f,%.2f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+        threads, queue_size, queue, wait, run, r->elapsed, r->tps,
+        r->wait.mean, r->wait.p50, r->wait.p90, r->wait.p99, r->wait.max,
+        r->response.mean, r->response.p50, r->response.p90, r->response.p99,
+        r->response.max);
+  } else {
+    printf("%s\n  {\"threads\": %s, \"queue_size\": %d, \"queue\": \"%s\", \"wait\": \"%s\", "
+        "\"run\": %d, \"elapsed_s\": %.3f, \"tps\": %.2f,\n"
+        "   \"wait_ms\": {\"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n"
+        "   \"response_ms\": {\"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}}",
+        index > 0 ? "," : "", threads, queue_size, queue, wait, run, r->elapsed, r->tps,
+        r->wait.mean, r->wait.p50, r->wait.p90, r->wait.p99, r->wait.max,
+        r->response.mean, r->response.p50, r->response.p90, r->response.p99,
+        r->response.max);
+  }
+  fflush(stdout);
+}
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "binlog.h"
+
+static void grow(binlog *l, size_t end);
+static size_t records_in(size_t length);
+
+// Address space for BINLOG_CAPACITY records is reserved up front and the file
+// is mapped at its start, each growth mapping the new part of the file right
+// after the old one, so the mapping never moves while threads write to it. The
+// file is cut down to the records used when it is closed.
+void binlog_open(binlog *l, const char *filename, int nthreads, int nslots) {
+    size_t reserve = sizeof(binlog_header) + sizeof(binlog_record) * BINLOG_CAPACITY;
+    l->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(l->fd < 0) {
+        perror("Could not open binary log file");
+        exit(1);
+    }
+    if(ftruncate(l->fd, BINLOG_INITIAL) != 0) {
+        perror("Could not size binary log file");
+        exit(1);
+    }
+    l->header = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1, 0);
+    if(l->header == MAP_FAILED || mmap(l->header, BINLOG_INITIAL, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_FIXED, l->fd, 0) == MAP_FAILED) {
+        perror("Could not map binary log file");
+        exit(1);
+    }
+    l->length = BINLOG_INITIAL;
+    atomic_init(&l->capacity, records_in(l->length));
+    pthread_mutex_init(&l->grow, NULL);
+    memcpy(l->header->magic, BINLOG_MAGIC, sizeof(l->header->magic));
+    l->header->record_size = sizeof(binlog_record);
+    l->header->nthreads = nthreads;
+    l->records = (binlog_record *)(l->header + 1);
+    atomic_init(&l->reserved, 0);
+    // One cursor per writing thread
+    l->cursors = aligned_alloc(CACHE_LINE, sizeof(binlog_cursor) * nslots);
+    if(l->cursors == NULL) {
+        perror("Binary log allocation failed");
+        exit(1);
+    }
+    memset(l->cursors, 0, sizeof(binlog_cursor) * nslots);
+}
+
+void binlog_append(binlog *l, int slot, int64_t ns, int msg, int val, int id, int depth) {
+    binlog_cursor *c = &l->cursors[slot];
+    if(c->next == c->end) {
+        c->next = atomic_fetch_add(&l->reserved, BINLOG_CHUNK);
+        c->end = c->next + BINLOG_CHUNK;
+        if(c->end > atomic_load_explicit(&l->capacity, memory_order_acquire)) {
+            grow(l, c->end);
+        }
+    }
+    binlog_record *r = &l->records[c->next++];
+    r->ns = ns;
+    r->id = id;
+    r->msg = msg;
+    r->val = val;
+    r->depth = depth;
+    r->flags = BINLOG_VALID;
+}
+
+void binlog_close(binlog *l, int64_t end_ns) {
+    size_t nrecords = atomic_load(&l->reserved);
+    size_t reserve = sizeof(binlog_header) + sizeof(binlog_record) * BINLOG_CAPACITY;
+    l->header->end_ns = end_ns;
+    l->header->nrecords = nrecords;
+    if(munmap(l->header, reserve) != 0) {
+        perror("Could not unmap binary log file");
+        exit(1);
+    }
+    if(ftruncate(l->fd, sizeof(binlog_header) + sizeof(binlog_record) * nrecords) != 0) {
+        perror("Could not truncate binary log file");
+        exit(1);
+    }
+    close(l->fd);
+    pthread_mutex_destroy(&l->grow);
+    free(l->cursors);
+}
+
+// Maps a closed binary log read-only and returns its records. header receives a
+// copy of the file header and length the size of the mapping.
+binlog_record *binlog_map(const char *filename, binlog_header *header, size_t *length) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        perror("Could not open binary log file");
+        exit(1);
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        perror("Could not stat binary log file");
+        exit(1);
+    }
+    *length = st.st_size;
+    if(*length < sizeof(binlog_header)) {
+        printf("Error: %s is not a binary log\n", filename);
+        exit(1);
+    }
+    binlog_header *h = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(h == MAP_FAILED) {
+        perror("Could not map binary log file");
+        exit(1);
+    }
+    close(fd);
+    if(memcmp(h->magic, BINLOG_MAGIC, sizeof(h->magic)) != 0 ||
+            h->record_size != sizeof(binlog_record) ||
+            *length < sizeof(binlog_header) + sizeof(binlog_record) * h->nrecords) {
+        printf("Error: %s is not a binary log\n", filename);
+        exit(1);
+    }
+    *header = *h;
+    return (binlog_record *)(h + 1);
+}
+
+// Doubles the file until it has room for records up to end. Threads writing to
+// the part already mapped carry on meanwhile; only those whose claims lie past
+// the end wait here.
+static void grow(binlog *l, size_t end) {
+    size_t reserve = sizeof(binlog_header) + sizeof(binlog_record) * BINLOG_CAPACITY;
+    pthread_mutex_lock(&l->grow);
+    while(atomic_load_explicit(&l->capacity, memory_order_relaxed) < end) {
+        if(l->length == reserve) {
+            printf("Error: Binary log capacity exceeded\n");
+            exit(1);
+        }
+        size_t length = (2 * l->length < reserve) ? 2 * l->length : reserve;
+        if(ftruncate(l->fd, length) != 0) {
+            perror("Could not grow binary log file");
+            exit(1);
+        }
+        if(mmap((char *)l->header + l->length, length - l->length, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, l->fd, l->length) == MAP_FAILED) {
+            perror("Could not map binary log file");
+            exit(1);
+        }
+        l->length = length;
+        atomic_store_explicit(&l->capacity, records_in(length), memory_order_release);
+    }
+    pthread_mutex_unlock(&l->grow);
+}
+
+static size_t records_in(size_t length) {
+    return (length - sizeof(binlog_header)) / sizeof(binlog_record);
+}
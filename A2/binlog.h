@@ -0,0 +1,71 @@
+#ifndef __BINLOG_H__
+#define __BINLOG_H__
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "lfring.h"
+
+#define BINLOG_MAGIC "PCBLOG1"
+#define BINLOG_VALID 1
+#define BINLOG_CHUNK 512
+// The file starts at BINLOG_INITIAL bytes and doubles when full, up to
+// BINLOG_CAPACITY records
+#define BINLOG_INITIAL (1L << 24)
+#define BINLOG_CAPACITY (1L << 36)
+
+typedef struct {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t nthreads;
+    int64_t end_ns;
+    int64_t nrecords;
+    char reserved[32];
+} binlog_header;
+
+/*
+* Fixed-width event record. Times are nanoseconds since the program started.
+* Records with flags cleared are unused tail slots of a thread's last chunk.
+*/
+typedef struct {
+    int64_t ns;
+    int32_t id;
+    int16_t msg;
+    int16_t flags;
+    int32_t val;
+    int32_t depth;
+} binlog_record;
+
+/*
+* Each thread, identified by its slot, claims BINLOG_CHUNK records of the mapped file at a time with one
+* atomic add and fills them without further synchronization. Only a claim past
+* the end of the file takes the lock, to grow it.
+*/
+typedef struct {
+    _Alignas(CACHE_LINE) size_t next;
+    size_t end;
+} binlog_cursor;
+
+typedef struct {
+    int fd;
+    binlog_header *header;
+    binlog_record *records;
+    _Alignas(CACHE_LINE) atomic_size_t reserved;
+    // Records the file has room for, and the bytes of it mapped
+    atomic_size_t capacity;
+    size_t length;
+    pthread_mutex_t grow;
+    binlog_cursor *cursors;
+} binlog;
+
+void binlog_open(binlog *l, const char *filename, int nthreads, int nslots);
+
+void binlog_append(binlog *l, int slot, int64_t ns, int msg, int val, int id, int depth);
+
+void binlog_close(binlog *l, int64_t end_ns);
+
+binlog_record *binlog_map(const char *filename, binlog_header *header, size_t *length);
+
+#endif
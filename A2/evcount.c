@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "evcount.h"
+
+static void futex_wait(atomic_uint *addr, unsigned val, bool shared);
+static void futex_wake(atomic_uint *addr, int n, bool shared);
+
+
+void evcount_init(evcount *e) {
+    atomic_init(&e->seq, 0);
+    atomic_init(&e->waiters, 0);
+    e->shared = false;
+}
+
+void evcount_init_shared(evcount *e) {
+    evcount_init(e);
+    e->shared = true;
+}
+
+unsigned evcount_prepare(evcount *e) {
+    atomic_fetch_add(&e->waiters, 1);
+    return atomic_load(&e->seq);
+}
+
+void evcount_cancel(evcount *e) {
+    atomic_fetch_sub(&e->waiters, 1);
+}
+
+// Sleeps until a notify after the matching prepare. May return spuriously.
+void evcount_wait(evcount *e, unsigned key) {
+    if(atomic_load(&e->seq) == key) {
+        futex_wait(&e->seq, key, e->shared);
+    }
+    atomic_fetch_sub(&e->waiters, 1);
+}
+
+// Wakes up to n waiters. Callers publish their work before notifying.
+void evcount_notify(evcount *e, int n) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&e->waiters, memory_order_relaxed) == 0) return;
+    atomic_fetch_add(&e->seq, 1);
+    futex_wake(&e->seq, n, e->shared);
+}
+
+void evcount_notify_all(evcount *e) {
+    atomic_fetch_add(&e->seq, 1);
+    futex_wake(&e->seq, INT_MAX, e->shared);
+}
+
+static void futex_wait(atomic_uint *addr, unsigned val, bool shared) {
+    if(syscall(SYS_futex, addr, shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0) != 0 &&
+            errno != EAGAIN && errno != EINTR) {
+        perror("Futex wait error");
+        exit(1);
+    }
+}
+
+static void futex_wake(atomic_uint *addr, int n, bool shared) {
+    if(syscall(SYS_futex, addr, shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0) < 0) {
+        perror("Futex wake error");
+        exit(1);
+    }
+}
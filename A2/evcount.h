@@ -0,0 +1,36 @@
+#ifndef __EVCOUNT_H__
+#define __EVCOUNT_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "lfring.h"
+
+/*
+* Eventcount for parking threads on a lock-free queue. A waiter registers with
+* evcount_prepare, re-checks the queue, and only then sleeps in evcount_wait, so
+* a notify that lands in between is never lost. Notifiers skip the futex call
+* entirely while nobody is registered. A shared eventcount lives in memory
+* mapped by several processes and uses process-shared futex operations.
+*/
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_uint seq;
+    atomic_int waiters;
+    bool shared;
+} evcount;
+
+void evcount_init(evcount *e);
+
+void evcount_init_shared(evcount *e);
+
+unsigned evcount_prepare(evcount *e);
+
+void evcount_cancel(evcount *e);
+
+void evcount_wait(evcount *e, unsigned key);
+
+void evcount_notify(evcount *e, int n);
+
+void evcount_notify_all(evcount *e);
+
+#endif
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <time.h>
+
+#include "evlog.h"
+
+
+int64_t evlog_now() {
+    struct timespec ts;
+    if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        perror("Clock get time failed");
+        exit(1);
+    }
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void evlog_init(evlog_buffer *b, int size) {
+    b->size = size;
+    b->records = malloc(sizeof(evlog_record) * b->size);
+    if(b->records == NULL) {
+        perror("Event buffer allocation failed");
+        exit(1);
+    }
+    atomic_init(&b->head, 0);
+    atomic_init(&b->tail, 0);
+    atomic_init(&b->stamping, false);
+}
+
+void evlog_deinit(evlog_buffer *b) {
+    free(b->records);
+}
+
+void evlog_append(int msg, int val, int id, int depth, evlog_buffer *b) {
+    size_t tail = atomic_load_explicit(&b->tail, memory_order_relaxed);
+    while(tail - atomic_load_explicit(&b->head, memory_order_acquire) >= b->size) {
+        // Buffer is full, wait for the writer to drain it
+        sched_yield();
+    }
+    atomic_store(&b->stamping, true);
+    evlog_record *r = &b->records[tail % b->size];
+    r->ns = evlog_now();
+    r->msg = msg;
+    r->val = val;
+    r->id = id;
+    r->depth = depth;
+    atomic_store_explicit(&b->tail, tail + 1, memory_order_release);
+    atomic_store(&b->stamping, false);
+}
+
+// Returns a time before which every record has been published. Any owner that
+// is not stamping once the clock has been read will take a later timestamp.
+int64_t evlog_horizon(evlog_buffer *buffers, int n) {
+    int64_t horizon = evlog_now();
+    for(int i=0; i<n; i++) {
+        while(atomic_load(&buffers[i].stamping)) {
+            sched_yield();
+        }
+    }
+    return horizon;
+}
+
+// Merges the records older than horizon from every buffer in timestamp order.
+// Each buffer is already ordered, so the oldest head record is emitted each step.
+int evlog_collect(evlog_buffer *buffers, int n, int64_t horizon,
+        void (*emit)(evlog_record *r)) {
+    int count = 0;
+    size_t heads[n], tails[n];
+    for(int i=0; i<n; i++) {
+        heads[i] = atomic_load_explicit(&buffers[i].head, memory_order_relaxed);
+        tails[i] = atomic_load_explicit(&buffers[i].tail, memory_order_acquire);
+    }
+    while(true) {
+        int oldest = -1;
+        for(int i=0; i<n; i++) {
+            if(heads[i] == tails[i]) continue;
+            evlog_record *r = &buffers[i].records[heads[i] % buffers[i].size];
+            if(r->ns >= horizon) continue;
+            if(oldest < 0 ||
+                    r->ns < buffers[oldest].records[heads[oldest] % buffers[oldest].size].ns) {
+                oldest = i;
+            }
+        }
+        if(oldest < 0) break;
+        emit(&buffers[oldest].records[heads[oldest] % buffers[oldest].size]);
+        heads[oldest]++;
+        count++;
+    }
+    for(int i=0; i<n; i++) {
+        atomic_store_explicit(&buffers[i].head, heads[i], memory_order_release);
+    }
+    return count;
+}
+
+// depth is the work queue depth right after a Work or Receive
+void evlog_format(FILE *fd, double t, int msg, int val, int id, int depth) {
+    fprintf(fd, "   %.3f", t);
+    fprintf(fd, " ID= %d", id);
+    switch(msg) {
+    case Ask:
+        fprintf(fd, "      Ask\n");
+        break;
+    case Receive:
+        fprintf(fd, " Q=%2d Receive      %d\n", depth, val);
+        break;
+    case Work:
+        fprintf(fd, " Q=%2d Work         %d\n", depth, val);
+        break;
+    case Complete:
+        fprintf(fd, "      Complete     %d\n", val);
+        break;
+    case Tands_Sleep:
+        fprintf(fd, "      Sleep        %d\n", val);
+        break;
+    case End:
+        fprintf(fd, "      End\n");
+        break;
+    case Resize:
+        fprintf(fd, "      Resize       %d\n", val);
+        break;
+    default:
+        fprintf(fd, "Called print_message with msg = %d\n", msg);
+    }
+}
+
+void evlog_summary(FILE *fd, int *msg_stats, int *thread_stats, int nthreads, double elapsed) {
+    fprintf(fd, "Summary:\n");
+    if(msg_stats[Work] > 999) {
+        fprintf(fd, "    Work       %d\n", msg_stats[Work]);
+    } else if(msg_stats[Work] > 99) {
+        fprintf(fd, "    Work        %d\n", msg_stats[Work]);
+    } else if(msg_stats[Work] > 9) {
+        fprintf(fd, "    Work         %d\n", msg_stats[Work]);
+    } else {
+        fprintf(fd, "    Work          %d\n", msg_stats[Work]);
+    }
+    if(msg_stats[Ask] > 999) {
+        fprintf(fd, "    Ask        %d\n", msg_stats[Ask]);
+    } else if(msg_stats[Ask] > 99) {
+        fprintf(fd, "    Ask         %d\n", msg_stats[Ask]);
+    } else if(msg_stats[Ask] > 9) {
+        fprintf(fd, "    Ask          %d\n", msg_stats[Ask]);
+    } else {
+        fprintf(fd, "    Ask           %d\n", msg_stats[Ask]);
+    }
+    if(msg_stats[Receive] > 999) {
+        fprintf(fd, "    Receive    %d\n", msg_stats[Receive]);
+    } else if(msg_stats[Receive] > 99) {
+        fprintf(fd, "    Receive     %d\n", msg_stats[Receive]);
+    } else if(msg_stats[Receive] > 9) {
+        fprintf(fd, "    Receive      %d\n", msg_stats[Receive]);
+    } else {
+        fprintf(fd, "    Receive       %d\n", msg_stats[Receive]);
+    }
+    if(msg_stats[Complete] > 999) {
+        fprintf(fd, "    Complete   %d\n", msg_stats[Complete]);
+    } else if(msg_stats[Complete] > 99) {
+        fprintf(fd, "    Complete    %d\n", msg_stats[Complete]);
+    } else if(msg_stats[Complete] > 9) {
+        fprintf(fd, "    Complete     %d\n", msg_stats[Complete]);
+    } else {
+        fprintf(fd, "    Complete      %d\n", msg_stats[Complete]);
+    }
+    if(msg_stats[Tands_Sleep] > 999) {
+        fprintf(fd, "    Sleep      %d\n", msg_stats[Tands_Sleep]);
+    } else if(msg_stats[Tands_Sleep] > 99) {
+        fprintf(fd, "    Sleep       %d\n", msg_stats[Tands_Sleep]);
+    } else if(msg_stats[Tands_Sleep] > 9) {
+        fprintf(fd, "    Sleep        %d\n", msg_stats[Tands_Sleep]);
+    } else {
+        fprintf(fd, "    Sleep         %d\n", msg_stats[Tands_Sleep]);
+    }
+    float total_trans = 0;
+    for(int i=0; i<nthreads; i++) {
+        total_trans += thread_stats[i];
+        evlog_thread_row(fd, i, thread_stats[i]);
+    }
+    fprintf(fd, "Transactions per second: %.2f\n", total_trans / elapsed);
+}
+
+// Aligns the value column for thread ids of up to four digits
+void evlog_thread_row(FILE *fd, int i, int val) {
+    if(i > 998) {
+        fprintf(fd, "    Thread  %d  %d\n", i+1, val);
+    } else if(i > 98) {
+        fprintf(fd, "    Thread  %d   %d\n", i+1, val);
+    } else if(i > 8) {
+        fprintf(fd, "    Thread  %d    %d\n", i+1, val);
+    } else {
+        fprintf(fd, "    Thread  %d     %d\n", i+1, val);
+    }
+}
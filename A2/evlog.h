@@ -0,0 +1,55 @@
+#ifndef __EVLOG_H__
+#define __EVLOG_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "lfring.h"
+
+enum message {Ask, Receive, Work, Complete, Tands_Sleep, End, Resize};
+#define MESSAGE_TYPES (Resize + 1)
+
+typedef struct {
+    int64_t ns;
+    int msg;
+    int val;
+    int id;
+    int depth;
+} evlog_record;
+
+/*
+* Single-writer event buffer. The owning thread appends records and a log writer
+* thread drains them, so the only shared state is the head and tail indices.
+* stamping is raised while the owner takes a timestamp for a record it has not
+* published yet, which lets the writer pick a horizon no later record can fall
+* behind.
+*/
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_size_t head;
+    _Alignas(CACHE_LINE) atomic_size_t tail;
+    atomic_bool stamping;
+    evlog_record *records;
+    size_t size;
+} evlog_buffer;
+
+int64_t evlog_now();
+
+void evlog_init(evlog_buffer *b, int size);
+
+void evlog_deinit(evlog_buffer *b);
+
+void evlog_append(int msg, int val, int id, int depth, evlog_buffer *b);
+
+int64_t evlog_horizon(evlog_buffer *buffers, int n);
+
+int evlog_collect(evlog_buffer *buffers, int n, int64_t horizon,
+    void (*emit)(evlog_record *r));
+
+void evlog_format(FILE *fd, double t, int msg, int val, int id, int depth);
+
+void evlog_summary(FILE *fd, int *msg_stats, int *thread_stats, int nthreads, double elapsed);
+
+void evlog_thread_row(FILE *fd, int i, int val);
+
+#endif
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "fiber.h"
+
+static void fiber_entry();
+static void push(fiber **head, fiber **tail, fiber *f);
+static fiber *pop(fiber **head, fiber **tail);
+
+// Worker running on the calling thread, if any
+static _Thread_local fiber_worker *current_worker = NULL;
+
+
+void fiber_worker_init(fiber_worker *w, int (*idle)(fiber_worker *w)) {
+    w->current = NULL;
+    w->ready_head = w->ready_tail = NULL;
+    w->parked_head = w->parked_tail = NULL;
+    w->nfibers = w->nparked = 0;
+    w->switches = 0;
+    w->idle = idle;
+}
+
+// Creates a ready fiber on the worker. Call before the worker starts running.
+void fiber_spawn(fiber_worker *w, fiber *f, void *(*fn)(void *), void *arg, size_t stack_size) {
+    long page = sysconf(_SC_PAGESIZE);
+    f->stack_size = ((stack_size + page - 1) / page + 1) * page;
+    f->stack = mmap(NULL, f->stack_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+    if(f->stack == MAP_FAILED) {
+        perror("Fiber stack allocation failed");
+        exit(1);
+    }
+    // Stacks grow down, so an overflow runs into the lowest page
+    if(mprotect(f->stack, page, PROT_NONE) != 0) {
+        perror("Fiber guard page failed");
+        exit(1);
+    }
+    if(getcontext(&f->ctx) != 0) {
+        perror("Get context failed");
+        exit(1);
+    }
+    f->ctx.uc_stack.ss_sp = f->stack;
+    f->ctx.uc_stack.ss_size = f->stack_size;
+    f->ctx.uc_link = &w->ctx;
+    makecontext(&f->ctx, fiber_entry, 0);
+    f->fn = fn;
+    f->arg = arg;
+    f->done = false;
+    push(&w->ready_head, &w->ready_tail, f);
+    w->nfibers++;
+}
+
+// Runs the worker's fibers on the calling thread until all of them finish
+void fiber_worker_run(fiber_worker *w) {
+    current_worker = w;
+    while(w->nfibers > 0) {
+        fiber *f = pop(&w->ready_head, &w->ready_tail);
+        if(f == NULL) {
+            for(int n = w->idle(w); n > 0 && w->nparked > 0; n--) {
+                push(&w->ready_head, &w->ready_tail, pop(&w->parked_head, &w->parked_tail));
+                w->nparked--;
+            }
+            continue;
+        }
+        w->current = f;
+        if(swapcontext(&w->ctx, &f->ctx) != 0) {
+            perror("Swap context failed");
+            exit(1);
+        }
+        w->switches++;
+        w->current = NULL;
+        if(f->done) {
+            w->nfibers--;
+        }
+    }
+    current_worker = NULL;
+}
+
+// Returns the fiber running on the calling thread, or NULL outside a fiber
+fiber *fiber_current() {
+    return (current_worker != NULL) ? current_worker->current : NULL;
+}
+
+// Moves the calling fiber to the back of its worker's run queue
+void fiber_yield() {
+    fiber_worker *w = current_worker;
+    fiber *f = w->current;
+    push(&w->ready_head, &w->ready_tail, f);
+    if(swapcontext(&f->ctx, &w->ctx) != 0) {
+        perror("Swap context failed");
+        exit(1);
+    }
+}
+
+// Suspends the calling fiber until its worker's idle function resumes it
+void fiber_park() {
+    fiber_worker *w = current_worker;
+    fiber *f = w->current;
+    push(&w->parked_head, &w->parked_tail, f);
+    w->nparked++;
+    if(swapcontext(&f->ctx, &w->ctx) != 0) {
+        perror("Swap context failed");
+        exit(1);
+    }
+}
+
+void fiber_deinit(fiber *f) {
+    munmap(f->stack, f->stack_size);
+}
+
+// First frame of every fiber. Returning resumes the worker through uc_link.
+static void fiber_entry() {
+    fiber *f = current_worker->current;
+    f->fn(f->arg);
+    f->done = true;
+}
+
+static void push(fiber **head, fiber **tail, fiber *f) {
+    f->next = NULL;
+    if(*tail == NULL) {
+        *head = f;
+    } else {
+        (*tail)->next = f;
+    }
+    *tail = f;
+}
+
+static fiber *pop(fiber **head, fiber **tail) {
+    fiber *f = *head;
+    if(f != NULL) {
+        *head = f->next;
+        if(*head == NULL) *tail = NULL;
+    }
+    return f;
+}
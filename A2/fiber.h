@@ -0,0 +1,50 @@
+#ifndef __FIBER_H__
+#define __FIBER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <ucontext.h>
+
+/*
+* Cooperative fibers multiplexed over worker threads. Each fiber belongs to one
+* worker for its whole life and runs on its own mmap stack with a guard page.
+* A worker keeps a run queue and a parked list that only its own thread
+* touches, so switching between fibers takes no locks. When no fiber is ready
+* the worker calls its idle function, which blocks until there may be
+* something to do and returns how many parked fibers to resume.
+*/
+typedef struct fiber {
+    ucontext_t ctx;
+    void *(*fn)(void *);
+    void *arg;
+    char *stack;
+    size_t stack_size;
+    bool done;
+    struct fiber *next;
+} fiber;
+
+typedef struct fiber_worker {
+    ucontext_t ctx;
+    fiber *current;
+    fiber *ready_head, *ready_tail;
+    fiber *parked_head, *parked_tail;
+    int nfibers, nparked;
+    long switches;
+    int (*idle)(struct fiber_worker *w);
+} fiber_worker;
+
+void fiber_worker_init(fiber_worker *w, int (*idle)(fiber_worker *w));
+
+void fiber_spawn(fiber_worker *w, fiber *f, void *(*fn)(void *), void *arg, size_t stack_size);
+
+void fiber_worker_run(fiber_worker *w);
+
+fiber *fiber_current();
+
+void fiber_yield();
+
+void fiber_park();
+
+void fiber_deinit(fiber *f);
+
+#endif
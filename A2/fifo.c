@@ -1,16 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <limits.h>
 
 #include "fifo.h"
 
-#define FIFO_EMPTY INT_MIN
-
 
 void fifo_init(fifo *f, int size) {
     f->size = size;
-    f->entries = malloc(sizeof(int) * f->size);
+    f->entries = malloc(sizeof(work_item) * f->size);
     f->count = 0;
     f->head = 0;
     f->tail = 0;
@@ -28,7 +25,7 @@ void fifo_deinit(fifo *f) {
     free(f->entries);
 }
 
-bool enqueue(int entry, fifo *f) {
+bool enqueue(work_item entry, fifo *f) {
     if(fifo_full(f)) return false;
     f->entries[f->tail] = entry;
     f->count++;
@@ -37,10 +34,10 @@ bool enqueue(int entry, fifo *f) {
     return true;
 }
 
-int dequeue(fifo *f) {
-    if(fifo_empty(f)) return FIFO_EMPTY;
-    int res = f->entries[f->head];
+bool dequeue(work_item *entry, fifo *f) {
+    if(fifo_empty(f)) return false;
+    *entry = f->entries[f->head];
     f->head = (f->head + 1) % f->size;
     f->count--;
-    return res;
+    return true;
 }
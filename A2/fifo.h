@@ -1,8 +1,19 @@
 #ifndef __FIFO_H__
 #define __FIFO_H__
 
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct work_item {
+    int work;
+    int count;
+    int64_t enq_ns;
+    // Set on the chunks of an item split across consumers
+    struct split_item *split;
+} work_item;
+
 typedef struct {
-    int *entries;
+    work_item *entries;
     int head, tail, count, size;
 } fifo;
 
@@ -14,8 +25,8 @@ bool fifo_full(fifo *f);
 
 void fifo_deinit(fifo *f);
 
-bool enqueue(int entry, fifo *f);
+bool enqueue(work_item entry, fifo *f);
 
-int dequeue(fifo *f);
+bool dequeue(work_item *entry, fifo *f);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "hist.h"
+
+#define LOAD(x) atomic_load_explicit(&(x), memory_order_relaxed)
+#define STORE(x, v) atomic_store_explicit(&(x), (v), memory_order_relaxed)
+
+static int bucket_index(int64_t val);
+static int64_t bucket_value(int idx);
+
+
+void hist_init(hist *h) {
+    memset(h, 0, sizeof(hist));
+}
+
+void hist_record(hist *h, int64_t val, int count) {
+    if(val < 0) val = 0;
+    int i = bucket_index(val);
+    STORE(h->counts[i], LOAD(h->counts[i]) + count);
+    STORE(h->total, LOAD(h->total) + count);
+    STORE(h->sum, LOAD(h->sum) + val * count);
+    if(val > LOAD(h->max)) STORE(h->max, val);
+}
+
+void hist_merge(hist *dst, const hist *src) {
+    for(int i=0; i<HIST_BUCKETS; i++) {
+        STORE(dst->counts[i], LOAD(dst->counts[i]) + LOAD(src->counts[i]));
+    }
+    STORE(dst->total, LOAD(dst->total) + LOAD(src->total));
+    STORE(dst->sum, LOAD(dst->sum) + LOAD(src->sum));
+    if(LOAD(src->max) > LOAD(dst->max)) STORE(dst->max, LOAD(src->max));
+}
+
+// Returns the highest value equivalent to the bucket holding the p-th percentile
+int64_t hist_percentile(const hist *h, double p) {
+    uint64_t total = LOAD(h->total);
+    int64_t max = LOAD(h->max);
+    if(total == 0) return 0;
+    uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+    if(rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for(int i=0; i<HIST_BUCKETS; i++) {
+        seen += LOAD(h->counts[i]);
+        if(seen >= rank) {
+            int64_t val = bucket_value(i);
+            return (val < max) ? val : max;
+        }
+    }
+    return max;
+}
+
+// Exact, since the sum is kept alongside the buckets
+double hist_mean(const hist *h) {
+    if(LOAD(h->total) == 0) return 0;
+    return (double)LOAD(h->sum) / LOAD(h->total);
+}
+
+// Sets dst to the values recorded between two snapshots of a histogram. Only
+// the maximum of the later snapshot is known, so it stands in for the window's.
+void hist_delta(hist *dst, const hist *now, const hist *before) {
+    for(int i=0; i<HIST_BUCKETS; i++) {
+        STORE(dst->counts[i], LOAD(now->counts[i]) - LOAD(before->counts[i]));
+    }
+    STORE(dst->total, LOAD(now->total) - LOAD(before->total));
+    STORE(dst->sum, LOAD(now->sum) - LOAD(before->sum));
+    STORE(dst->max, LOAD(now->max));
+}
+
+// Values below HIST_SUB_COUNT get a bucket each. Above that the top
+// HIST_SUB_BITS bits after the leading one pick the bucket within its power of two.
+static int bucket_index(int64_t val) {
+    if(val < HIST_SUB_COUNT) return (int)val;
+    int shift = 63 - __builtin_clzll((unsigned long long)val) - HIST_SUB_BITS;
+    int sub = (int)((val >> shift) & (HIST_SUB_COUNT - 1));
+    return ((shift + 1) << HIST_SUB_BITS) + sub;
+}
+
+static int64_t bucket_value(int idx) {
+    if(idx < HIST_SUB_COUNT) return idx;
+    int shift = (idx >> HIST_SUB_BITS) - 1;
+    int64_t sub = idx & (HIST_SUB_COUNT - 1);
+    return ((HIST_SUB_COUNT + sub + 1) << shift) - 1;
+}
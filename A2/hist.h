@@ -0,0 +1,39 @@
+#ifndef __HIST_H__
+#define __HIST_H__
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+/*
+* Log-linear latency histogram in the style of HdrHistogram. Every power of two
+* is split into HIST_SUB_COUNT equal buckets, so a recorded value is known to
+* within about 6% across the full 64-bit range.
+*
+* A histogram has a single writer. Its fields are relaxed atomics updated with
+* plain loads and stores, so other threads can read a running histogram without
+* locks and without slowing the writer.
+*/
+typedef struct {
+    _Atomic uint32_t counts[HIST_BUCKETS];
+    _Atomic uint64_t total;
+    _Atomic int64_t sum;
+    _Atomic int64_t max;
+} hist;
+
+void hist_init(hist *h);
+
+void hist_record(hist *h, int64_t val, int count);
+
+void hist_merge(hist *dst, const hist *src);
+
+int64_t hist_percentile(const hist *h, double p);
+
+double hist_mean(const hist *h);
+
+void hist_delta(hist *dst, const hist *now, const hist *before);
+
+#endif
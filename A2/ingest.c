@@ -0,0 +1,226 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ingest.h"
+
+enum scan_state {Line_Start, Space, Digits, Skip_Line};
+
+static void * read_blocks(void *arg);
+static bool next_block(ingest *in);
+static bool end_command(ingest *in, char *c, int *n);
+
+
+// Scans the lines starting in [begin, end) of a regular file, or all input when
+// end is negative
+void ingest_open_range(ingest *in, int fd, off_t begin, off_t end) {
+    memset(in, 0, sizeof(ingest));
+    in->fd = fd;
+    in->state = Line_Start;
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        perror("Could not stat input");
+        exit(1);
+    }
+    if(S_ISREG(st.st_mode) && st.st_size > 0) {
+        in->map_len = st.st_size;
+        in->map = mmap(NULL, in->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(in->map == MAP_FAILED) {
+            perror("Could not map input");
+            exit(1);
+        }
+        madvise(in->map, in->map_len, MADV_SEQUENTIAL);
+        in->begin = (begin < 0) ? 0 : (size_t)begin;
+        in->end = (end < 0 || (size_t)end > in->map_len) ? in->map_len : (size_t)end;
+        // Move both bounds up to a line start so no line is split between shards
+        while(in->begin > 0 && in->begin < in->map_len && in->map[in->begin - 1] != '\n') {
+            in->begin++;
+        }
+        while(in->end > 0 && in->end < in->map_len && in->map[in->end - 1] != '\n') {
+            in->end++;
+        }
+        return;
+    }
+    if(S_ISREG(st.st_mode)) {
+        // Empty file, nothing to read
+        return;
+    }
+    if(begin > 0 || end >= 0) {
+        printf("Error: Input shards need a regular file\n");
+        exit(1);
+    }
+    in->threaded = true;
+    for(int i=0; i<2; i++) {
+        if((in->blocks[i] = malloc(INGEST_BLOCK)) == NULL) {
+            perror("Input buffer allocation failed");
+            exit(1);
+        }
+    }
+    pthread_mutex_init(&in->lock, NULL);
+    pthread_cond_init(&in->changed, NULL);
+    pthread_create(&in->reader, NULL, &read_blocks, in);
+}
+
+// Returns the next command in c and its value in n, or false at the end of input
+bool ingest_next(ingest *in, char *c, int *n) {
+    while(true) {
+        if(in->pos == in->len) {
+            if(!next_block(in)) {
+                return end_command(in, c, n);
+            }
+            continue;
+        }
+        char ch = in->data[in->pos++];
+        if(in->state == Line_Start) {
+            // Blank lines are invalid commands too
+            if(ch != 'T' && ch != 'S') {
+                printf("Error: Invalid command provided\n");
+                exit(1);
+            }
+            in->cmd = ch;
+            in->val = 0;
+            in->sign = 1;
+            in->overflow = false;
+            in->column = 1;
+            in->state = Space;
+            continue;
+        }
+        if(ch == '\n') {
+            return end_command(in, c, n);
+        }
+        switch(in->state) {
+        case Space:
+            // As atoi: leading white space, one sign, then digits
+            if(ch == ' ' || ch == '\t' || ch == '\r' || ch == '\v' || ch == '\f') {
+                break;
+            }
+            in->state = Digits;
+            if(ch == '-' || ch == '+') {
+                in->sign = (ch == '-') ? -1 : 1;
+                break;
+            }
+            // fall through
+        case Digits:
+            if(ch < '0' || ch > '9') {
+                // Anything after the number is ignored
+                in->state = Skip_Line;
+            } else if(in->val > (LONG_MAX - (ch - '0')) / 10) {
+                in->overflow = true;
+            } else {
+                in->val = in->val * 10 + (ch - '0');
+            }
+            break;
+        }
+        // A longer line is read as several, the rest starting a new command
+        if(++in->column == INGEST_LINE - 1) {
+            return end_command(in, c, n);
+        }
+    }
+}
+
+void ingest_close(ingest *in) {
+    if(in->map != NULL) {
+        munmap(in->map, in->map_len);
+    }
+    if(in->threaded) {
+        pthread_join(in->reader, NULL);
+        free(in->blocks[0]);
+        free(in->blocks[1]);
+        pthread_mutex_destroy(&in->lock);
+        pthread_cond_destroy(&in->changed);
+    }
+}
+
+// Finishes the command being scanned, if any, and checks its value. An out of
+// range value saturates to a long and is then narrowed to int, as atoi does.
+static bool end_command(ingest *in, char *c, int *n) {
+    if(in->cmd == 0) {
+        return false;
+    }
+    *c = in->cmd;
+    if(in->overflow) {
+        *n = (int)(in->sign > 0 ? LONG_MAX : LONG_MIN);
+    } else {
+        *n = (int)(in->sign * in->val);
+    }
+    in->cmd = 0;
+    in->state = Line_Start;
+    if(*n == 0) {
+        printf("Error invalid integet provided\n");
+        exit(1);
+    }
+    return true;
+}
+
+// Moves on to the next block of input, handing the finished one back to the reader
+static bool next_block(ingest *in) {
+    if(!in->threaded) {
+        if(in->data != NULL || in->map == NULL || in->begin >= in->end) return false;
+        in->data = in->map + in->begin;
+        in->len = in->end - in->begin;
+        in->pos = 0;
+        return true;
+    }
+    if(in->eof) return false;
+    pthread_mutex_lock(&in->lock);
+    if(in->started) {
+        in->full[in->current] = false;
+        in->current ^= 1;
+        pthread_cond_broadcast(&in->changed);
+    }
+    in->started = true;
+    if(!in->full[in->current] && in->before_wait != NULL) {
+        pthread_mutex_unlock(&in->lock);
+        in->before_wait();
+        pthread_mutex_lock(&in->lock);
+    }
+    while(!in->full[in->current]) {
+        pthread_cond_wait(&in->changed, &in->lock);
+    }
+    in->data = in->blocks[in->current];
+    in->len = in->lens[in->current];
+    in->pos = 0;
+    pthread_mutex_unlock(&in->lock);
+    // An empty block marks the end of input, after which the reader has exited
+    in->eof = (in->len == 0);
+    return !in->eof;
+}
+
+// Reader thread task. Fills the two blocks in turn until the end of input.
+static void * read_blocks(void *arg) {
+    ingest *in = (ingest *)arg;
+    int i = 0;
+    while(true) {
+        pthread_mutex_lock(&in->lock);
+        while(in->full[i]) {
+            pthread_cond_wait(&in->changed, &in->lock);
+        }
+        pthread_mutex_unlock(&in->lock);
+        // Stop filling early when the pipe runs dry so a slow writer's lines
+        // are not held back waiting for a full block
+        size_t len = 0;
+        ssize_t bytes;
+        while(len < INGEST_BLOCK) {
+            size_t want = INGEST_BLOCK - len;
+            if((bytes = read(in->fd, in->blocks[i] + len, want)) < 0) {
+                perror("Read error");
+                exit(1);
+            }
+            len += bytes;
+            if((size_t)bytes < want) break;
+        }
+        pthread_mutex_lock(&in->lock);
+        in->lens[i] = len;
+        in->full[i] = true;
+        pthread_cond_broadcast(&in->changed);
+        pthread_mutex_unlock(&in->lock);
+        if(len == 0) break;
+        i ^= 1;
+    }
+    return NULL;
+}
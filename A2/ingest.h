@@ -0,0 +1,56 @@
+#ifndef __INGEST_H__
+#define __INGEST_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define INGEST_BLOCK (1 << 20)
+// Buffer size of the line-at-a-time reader, whose lines this one matches
+#define INGEST_LINE 100
+
+/*
+* Streaming reader for T/S command input. A regular file is mapped and scanned
+* in place. Anything else is read in large blocks by a helper thread into two
+* buffers, so reading the next block overlaps with parsing the current one.
+* A mapped file can also be scanned in shards: each shard holds the lines that
+* start inside its byte range. Lines are taken exactly as the line-at-a-time
+* reader takes them: at most INGEST_LINE - 1 bytes at a time, a T or S first
+* and the value read as atoi reads it.
+*/
+typedef struct {
+    // Block being scanned and parser state carried across blocks
+    const char *data;
+    size_t len, pos;
+    int state, sign, column;
+    char cmd;
+    long val;
+    bool overflow;
+    // Mapped regular file and the shard of it to scan
+    char *map;
+    size_t map_len;
+    size_t begin, end;
+    // Double-buffered pipe reader
+    int fd;
+    bool threaded;
+    char *blocks[2];
+    size_t lens[2];
+    bool full[2];
+    int current;
+    bool started;
+    bool eof;
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    // Called, when set, before the parser waits on the reader for more input
+    void (*before_wait)(void);
+} ingest;
+
+void ingest_open_range(ingest *in, int fd, off_t begin, off_t end);
+
+bool ingest_next(ingest *in, char *c, int *n);
+
+void ingest_close(ingest *in);
+
+#endif
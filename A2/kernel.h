@@ -0,0 +1,26 @@
+#ifndef __KERNEL_H__
+#define __KERNEL_H__
+
+#include <stdint.h>
+
+/*
+* Registry of transaction kernels. "trans" is Trans from tands.c and stays the
+* default. "hash" runs FNV-1a over a buffer that fits in cache, "sort" sorts
+* an array of random integers and "stream" sums a buffer far larger than the
+* last level cache, so the three cover ALU-bound, branchy and memory-bound
+* work. Each kernel repeats a base step, calibrated when it is first looked up
+* so that one unit of work costs about as much as Trans(1). Work n runs n
+* units on the calling thread.
+*/
+typedef struct kernel {
+    const char *name;
+    void (*step)(void);
+    int reps;
+    int64_t unit_ns;
+} kernel;
+
+kernel *kernel_find(const char *name);
+
+void kernel_run(const kernel *k, int n);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "lfring.h"
+
+// Bounded MPMC queue after Dmitry Vyukov
+// https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+
+
+void lfring_init(lfring *r, int size) {
+    void *slots = aligned_alloc(CACHE_LINE, lfring_bytes(size));
+    if(slots == NULL) {
+        perror("Ring allocation failed");
+        exit(1);
+    }
+    lfring_init_at(r, size, slots);
+}
+
+// Bytes of slot storage for a ring of size entries, in whole cache lines
+size_t lfring_bytes(int size) {
+    // A one-slot ring cannot tell a filled slot from one freed a lap later
+    size = (size < 2) ? 2 : size;
+    return ((sizeof(lfring_slot) * size + CACHE_LINE - 1) / CACHE_LINE) * CACHE_LINE;
+}
+
+// Sets up a ring over caller-provided slot storage of lfring_bytes(size), such
+// as shared memory. lfring_deinit must not be called on it.
+void lfring_init_at(lfring *r, int size, void *slots) {
+    r->size = (size < 2) ? 2 : size;
+    r->slots = slots;
+    for(size_t i=0; i<r->size; i++) {
+        atomic_init(&r->slots[i].seq, i);
+    }
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+}
+
+void lfring_deinit(lfring *r) {
+    free(r->slots);
+}
+
+bool lfring_enqueue(work_item entry, lfring *r) {
+    size_t pos;
+    if(lfring_claim(1, &pos, r) == 0) return false;
+    lfring_publish(&entry, 1, pos, r);
+    return true;
+}
+
+bool lfring_dequeue(work_item *entry, lfring *r) {
+    return lfring_dequeue_batch(entry, 1, r) == 1;
+}
+
+// Claims up to n consecutive free slots with a single CAS on tail, returning
+// how many and the position of the first in pos. A slot whose sequence equals
+// its position can only be written by the thread that moves tail past it, so
+// the slots checked before the CAS stay free after it. Consumers see nothing
+// until the claimed slots are published.
+int lfring_claim(int n, size_t *pos, lfring *r) {
+    *pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    while(true) {
+        int avail = 0;
+        while(avail < n && avail < (int)r->size) {
+            lfring_slot *slot = &r->slots[(*pos + avail) % r->size];
+            size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+            if(seq != *pos + avail) break;
+            avail++;
+        }
+        if(avail == 0) {
+            lfring_slot *slot = &r->slots[*pos % r->size];
+            size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+            // Slot still holds an entry from the previous lap, ring is full
+            if((long)seq - (long)*pos < 0) return 0;
+            *pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+            continue;
+        }
+        if(atomic_compare_exchange_weak_explicit(&r->tail, pos, *pos + avail,
+                memory_order_relaxed, memory_order_relaxed)) {
+            return avail;
+        }
+    }
+}
+
+// Fills n slots claimed from pos and hands them to consumers
+void lfring_publish(const work_item *entries, int n, size_t pos, lfring *r) {
+    for(int i=0; i<n; i++) {
+        lfring_slot *slot = &r->slots[(pos + i) % r->size];
+        slot->entry = entries[i];
+        atomic_store_explicit(&slot->seq, pos + i + 1, memory_order_release);
+    }
+}
+
+// Claims up to max consecutive filled slots with a single CAS on head
+int lfring_dequeue_batch(work_item *entries, int max, lfring *r) {
+    size_t pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+    while(true) {
+        int avail = 0;
+        while(avail < max && avail < (int)r->size) {
+            lfring_slot *slot = &r->slots[(pos + avail) % r->size];
+            size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+            if(seq != pos + avail + 1) break;
+            avail++;
+        }
+        if(avail == 0) {
+            lfring_slot *slot = &r->slots[pos % r->size];
+            size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+            // Producer has not filled this slot yet, ring is empty
+            if((long)seq - (long)(pos + 1) < 0) return 0;
+            pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+            continue;
+        }
+        if(atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + avail,
+                memory_order_relaxed, memory_order_relaxed)) {
+            for(int i=0; i<avail; i++) {
+                lfring_slot *slot = &r->slots[(pos + i) % r->size];
+                entries[i] = slot->entry;
+                atomic_store_explicit(&slot->seq, pos + i + r->size, memory_order_release);
+            }
+            return avail;
+        }
+    }
+}
+
+int lfring_count(lfring *r) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    return (tail > head) ? (int)(tail - head) : 0;
+}
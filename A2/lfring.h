@@ -0,0 +1,49 @@
+#ifndef __LFRING_H__
+#define __LFRING_H__
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "fifo.h"
+
+#define CACHE_LINE 64
+
+/*
+* Bounded multi-producer/multi-consumer ring. Each slot carries a sequence
+* number that tells a producer when the slot is free and a consumer when it
+* has been filled, so neither side needs a lock. head and tail live on their
+* own cache lines so producers and consumers do not invalidate each other.
+*/
+typedef struct {
+    atomic_size_t seq;
+    work_item entry;
+} lfring_slot;
+
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_size_t head;
+    _Alignas(CACHE_LINE) atomic_size_t tail;
+    _Alignas(CACHE_LINE) lfring_slot *slots;
+    size_t size;
+} lfring;
+
+void lfring_init(lfring *r, int size);
+
+size_t lfring_bytes(int size);
+
+void lfring_init_at(lfring *r, int size, void *slots);
+
+void lfring_deinit(lfring *r);
+
+bool lfring_enqueue(work_item entry, lfring *r);
+
+bool lfring_dequeue(work_item *entry, lfring *r);
+
+int lfring_claim(int n, size_t *pos, lfring *r);
+
+void lfring_publish(const work_item *entries, int n, size_t pos, lfring *r);
+
+int lfring_dequeue_batch(work_item *entries, int max, lfring *r);
+
+int lfring_count(lfring *r);
+
+#endif
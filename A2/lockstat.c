@@ -0,0 +1,57 @@
+#include <errno.h>
+#include <stdio.h>
+
+#include "evlog.h"
+#include "lockstat.h"
+
+static void waited(lockstat *s, int64_t ns);
+
+
+// Takes the lock, timing the wait only when the first try finds it held. A
+// robust mutex whose owner died is still acquired, so EOWNERDEAD counts too.
+int lockstat_lock(pthread_mutex_t *m, lockstat *s) {
+    int err = pthread_mutex_trylock(m);
+    if(err == EBUSY) {
+        int64_t begin = evlog_now();
+        err = pthread_mutex_lock(m);
+        s->locked_ns = evlog_now();
+        s->contended++;
+        waited(s, s->locked_ns - begin);
+    } else {
+        s->locked_ns = evlog_now();
+    }
+    if(err == 0 || err == EOWNERDEAD) {
+        s->acquires++;
+    }
+    return err;
+}
+
+int lockstat_unlock(pthread_mutex_t *m, lockstat *s) {
+    s->hold_ns += evlog_now() - s->locked_ns;
+    return pthread_mutex_unlock(m);
+}
+
+// The mutex is released for the wait, so its hold ends here and restarts on
+// wakeup with the mutex held again
+int lockstat_wait(pthread_cond_t *c, pthread_mutex_t *m, lockstat *cs, lockstat *ms) {
+    int64_t begin = evlog_now();
+    ms->hold_ns += begin - ms->locked_ns;
+    int err = pthread_cond_wait(c, m);
+    ms->locked_ns = evlog_now();
+    cs->acquires++;
+    waited(cs, ms->locked_ns - begin);
+    return err;
+}
+
+void lockstat_merge(lockstat *dst, const lockstat *src) {
+    dst->acquires += src->acquires;
+    dst->contended += src->contended;
+    dst->wait_ns += src->wait_ns;
+    if(src->max_wait_ns > dst->max_wait_ns) dst->max_wait_ns = src->max_wait_ns;
+    dst->hold_ns += src->hold_ns;
+}
+
+void waited(lockstat *s, int64_t ns) {
+    s->wait_ns += ns;
+    if(ns > s->max_wait_ns) s->max_wait_ns = ns;
+}
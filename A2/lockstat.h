@@ -0,0 +1,32 @@
+#ifndef __LOCKSTAT_H__
+#define __LOCKSTAT_H__
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+* Contention counters for one lock as seen by one thread. An acquisition first
+* tries the lock, so only contended acquisitions pay for timing the wait; hold
+* time runs from acquisition to release. A condition wait counts as one
+* acquisition of its condition whose wait spans the sleep and the relock, and
+* ends the hold of its mutex until it returns. Each thread only updates its
+* own counters, so they need no synchronization of their own.
+*/
+typedef struct {
+    long acquires;
+    long contended;
+    int64_t wait_ns;
+    int64_t max_wait_ns;
+    int64_t hold_ns;
+    int64_t locked_ns;
+} lockstat;
+
+int lockstat_lock(pthread_mutex_t *m, lockstat *s);
+
+int lockstat_unlock(pthread_mutex_t *m, lockstat *s);
+
+int lockstat_wait(pthread_cond_t *c, pthread_mutex_t *m, lockstat *cs, lockstat *ms);
+
+void lockstat_merge(lockstat *dst, const lockstat *src);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* User defined headers */
+#include "binlog.h"
+#include "evlog.h"
+
+/* Private function prototypes */
+static int compare_records(const void *a, const void *b);
+
+
+/*
+* Main program
+*
+* Renders a binary prodcon log as the usual text log followed by its summary.
+* Output goes to the named file, or to stdout when none is given.
+*/
+int main(int argc, char *argv[]) {
+  if(argc < 2) {
+    printf("Usage: prodcon-logdump file.blog [output]\n");
+    exit(1);
+  }
+  binlog_header header;
+  size_t length;
+  binlog_record *records = binlog_map(argv[1], &header, &length);
+  FILE *fd = stdout;
+  if(argc > 2 && (fd = fopen(argv[2], "w+")) == NULL) {
+    perror("Could not open output file");
+    exit(1);
+  }
+
+  // Gather the filled records; threads fill their chunks in order, but chunks
+  // from different threads interleave in the file
+  binlog_record **sorted = malloc(sizeof(binlog_record *) * (header.nrecords + 1));
+  size_t n = 0;
+  for(size_t i=0; i<header.nrecords; i++) {
+    if(records[i].flags & BINLOG_VALID) {
+      sorted[n++] = &records[i];
+    }
+  }
+  qsort(sorted, n, sizeof(binlog_record *), compare_records);
+
+  // Write the log and rebuild msg_stats[] and thread_stats[] from it
+  int msg_stats[MESSAGE_TYPES] = {0};
+  int *thread_stats = calloc(header.nthreads + 1, sizeof(int));
+  for(size_t i=0; i<n; i++) {
+    binlog_record *r = sorted[i];
+    if(r->msg < Ask || r->msg >= MESSAGE_TYPES) {
+      printf("Error: Invalid message type in record %zu\n", i);
+      exit(1);
+    }
+    msg_stats[r->msg] += 1;
+    if(r->msg == Complete && r->id > 0 && r->id <= header.nthreads) {
+      thread_stats[r->id-1] += 1;
+    }
+    evlog_format(fd, r->ns / 1000000000.0, r->msg, r->val, r->id, r->depth);
+  }
+  evlog_summary(fd, msg_stats, thread_stats, header.nthreads, header.end_ns / 1000000000.0);
+
+  free(sorted);
+  free(thread_stats);
+  if(fd != stdout) {
+    fclose(fd);
+  }
+  return 0;
+}
+
+
+/*
+* Compare records
+*
+* Orders records by timestamp, keeping file order for equal timestamps
+*/
+int compare_records(const void *a, const void *b) {
+  const binlog_record *ra = *(const binlog_record **)a;
+  const binlog_record *rb = *(const binlog_record **)b;
+  if(ra->ns != rb->ns) {
+    return (ra->ns < rb->ns) ? -1 : 1;
+  }
+  return (ra < rb) ? -1 : (ra > rb);
+}
@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+typedef struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} perfctr_event;
+
+static const perfctr_event hardware_events[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+};
+
+static const perfctr_event software_events[] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock-ms"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "ctx-switches"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults"},
+};
+
+static const perfctr_event *events = hardware_events;
+static int nevents = 4;
+
+static int open_event(const perfctr_event *e, bool exclude_kernel);
+static long thread_csw();
+
+
+// Tries the hardware set on the calling thread and falls back to the software
+// set. Returns false when neither can be opened.
+bool perfctr_probe() {
+    perfctr c;
+    events = hardware_events;
+    nevents = sizeof(hardware_events) / sizeof(perfctr_event);
+    if(perfctr_open(&c)) {
+        perfctr_close(&c);
+        return true;
+    }
+    events = software_events;
+    nevents = sizeof(software_events) / sizeof(perfctr_event);
+    if(perfctr_open(&c)) {
+        perfctr_close(&c);
+        return true;
+    }
+    return false;
+}
+
+int perfctr_count() {
+    return nevents;
+}
+
+const char *perfctr_name(int i) {
+    return events[i].name;
+}
+
+// Opens every counter of the chosen set or none of them. A software event the
+// kernel may not be counted for is opened for user space only, except context
+// switches, which only happen in the kernel and are read from getrusage.
+bool perfctr_open(perfctr *c) {
+    c->n = 0;
+    for(int i=0; i<nevents; i++) {
+        const perfctr_event *e = &events[i];
+        int fd = open_event(e, e->type == PERF_TYPE_HARDWARE);
+        if(fd < 0 && (errno == EACCES || errno == EPERM) && e->type == PERF_TYPE_SOFTWARE) {
+            if(e->config == PERF_COUNT_SW_CONTEXT_SWITCHES) {
+                fd = PERFCTR_RUSAGE;
+                c->csw_base = thread_csw();
+            } else {
+                fd = open_event(e, true);
+            }
+        }
+        if(fd == -1) {
+            perfctr_close(c);
+            return false;
+        }
+        c->fds[c->n++] = fd;
+    }
+    return true;
+}
+
+// Values are scaled up by enabled over running time when the kernel had to
+// multiplex more counters than the PMU holds. Task clock is given in ms.
+void perfctr_read(perfctr *c, uint64_t *values) {
+    for(int i=0; i<c->n; i++) {
+        uint64_t buf[3];
+        if(c->fds[i] == PERFCTR_RUSAGE) {
+            values[i] = thread_csw() - c->csw_base;
+            continue;
+        }
+        if(read(c->fds[i], buf, sizeof(buf)) != sizeof(buf)) {
+            perror("Counter read failed");
+            exit(1);
+        }
+        uint64_t value = buf[0];
+        if(buf[2] > 0 && buf[2] < buf[1]) {
+            value = (uint64_t)((double)value * buf[1] / buf[2]);
+        }
+        if(events[i].type == PERF_TYPE_SOFTWARE && events[i].config == PERF_COUNT_SW_TASK_CLOCK) {
+            value /= 1000000;
+        }
+        values[i] = value;
+    }
+}
+
+void perfctr_close(perfctr *c) {
+    for(int i=0; i<c->n; i++) {
+        if(c->fds[i] >= 0) {
+            close(c->fds[i]);
+        }
+    }
+    c->n = 0;
+}
+
+// Counts the calling thread on any CPU. Hardware events count user space
+// only, which needs no privilege; software events such as context switches
+// happen in the kernel, so those include it where permitted.
+int open_event(const perfctr_event *e, bool exclude_kernel) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = e->type;
+    attr.config = e->config;
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Voluntary and involuntary context switches of the calling thread
+long thread_csw() {
+    struct rusage usage;
+    if(getrusage(RUSAGE_THREAD, &usage) != 0) {
+        perror("Getrusage failed");
+        exit(1);
+    }
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
@@ -0,0 +1,39 @@
+#ifndef __PERFCTR_H__
+#define __PERFCTR_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PERFCTR_MAX 4
+// Stands in for a counter fd when the count comes from getrusage
+#define PERFCTR_RUSAGE (-2)
+
+/*
+* Per-thread performance counters from perf_event_open. The hardware set
+* counts cycles, instructions, cache misses and branch misses in user space.
+* Where the PMU is unavailable, as in most virtual machines, the software set
+* of task clock, context switches and page faults is used instead.
+* perfctr_probe picks the set once; every thread then opens its own counters,
+* which count only that thread. Where the kernel may not be counted, as for
+* unprivileged users by default, software events count user space only and
+* context switches are taken from getrusage instead.
+*/
+typedef struct {
+    int fds[PERFCTR_MAX];
+    int n;
+    long csw_base;
+} perfctr;
+
+bool perfctr_probe();
+
+int perfctr_count();
+
+const char *perfctr_name(int i);
+
+bool perfctr_open(perfctr *c);
+
+void perfctr_read(perfctr *c, uint64_t *values);
+
+void perfctr_close(perfctr *c);
+
+#endif
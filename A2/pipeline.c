@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "evlog.h"
+#include "pipeline.h"
+
+typedef struct {
+    stage *s;
+    int worker;
+} stage_arg;
+
+static void * run_stage(void *arg);
+static void put(stage *s, work_item *item, stage_stat *st);
+static bool get(stage *s, work_item *item);
+static void close_stage(stage *s);
+
+
+// Each of the nsubmitters threads that submit items gets its own counters
+void pipeline_init(pipeline *p, int nstages, int nsubmitters) {
+    p->nstages = nstages;
+    p->nsubmitters = nsubmitters;
+    p->stages = calloc(nstages, sizeof(stage));
+    p->submit = aligned_alloc(CACHE_LINE, sizeof(stage_stat) * nsubmitters);
+    if(p->stages == NULL || p->submit == NULL) {
+        perror("Pipeline allocation failed");
+        exit(1);
+    }
+    memset(p->submit, 0, sizeof(stage_stat) * nsubmitters);
+}
+
+// Sets up stage i, whose workers take the ids first_id onwards
+void pipeline_stage(pipeline *p, int i, const char *name, stage_fn fn, int nworkers,
+        int queue_size, int first_id) {
+    stage *s = &p->stages[i];
+    s->name = name;
+    s->fn = fn;
+    s->index = i;
+    s->nworkers = nworkers;
+    s->first_id = first_id;
+    s->p = p;
+    lfring_init(&s->queue, queue_size);
+    evcount_init(&s->not_empty);
+    evcount_init(&s->not_full);
+    atomic_init(&s->closed, false);
+    atomic_init(&s->active, nworkers);
+    atomic_init(&s->max_depth, 0);
+    s->stats = aligned_alloc(CACHE_LINE, sizeof(stage_stat) * nworkers);
+    s->threads = malloc(sizeof(pthread_t) * nworkers);
+    if(s->stats == NULL || s->threads == NULL) {
+        perror("Stage allocation failed");
+        exit(1);
+    }
+    memset(s->stats, 0, sizeof(stage_stat) * nworkers);
+}
+
+void pipeline_start(pipeline *p) {
+    for(int i=0; i<p->nstages; i++) {
+        stage *s = &p->stages[i];
+        for(int j=0; j<s->nworkers; j++) {
+            stage_arg *arg = malloc(sizeof(stage_arg));
+            arg->s = s;
+            arg->worker = j;
+            pthread_create(&s->threads[j], NULL, &run_stage, arg);
+        }
+    }
+}
+
+// Hands an item to the first stage, waiting while its queue is full
+void pipeline_submit(pipeline *p, int submitter, work_item item) {
+    put(&p->stages[0], &item, &p->submit[submitter]);
+}
+
+// Marks the end of input and waits for every stage to drain
+void pipeline_close(pipeline *p) {
+    close_stage(&p->stages[0]);
+    for(int i=0; i<p->nstages; i++) {
+        for(int j=0; j<p->stages[i].nworkers; j++) {
+            if(pthread_join(p->stages[i].threads[j], NULL) != 0) {
+                printf("Pthread join failed\n");
+                exit(1);
+            }
+        }
+    }
+}
+
+void pipeline_summary(FILE *fd, pipeline *p) {
+    fprintf(fd, "%-18s %8s %8s %8s %8s %8s %8s %8s\n", "Pipeline:", "threads", "items",
+        "busy ms", "mean ms", "stalls", "stall ms", "max Q");
+    for(int i=0; i<p->nstages; i++) {
+        stage *s = &p->stages[i];
+        stage_stat total = {0};
+        for(int j=0; j<s->nworkers; j++) {
+            total.items += s->stats[j].items;
+            total.busy_ns += s->stats[j].busy_ns;
+            total.stalls += s->stats[j].stalls;
+            total.stall_ns += s->stats[j].stall_ns;
+        }
+        char label[16];
+        snprintf(label, sizeof(label), "%d %s", i+1, s->name);
+        fprintf(fd, "    %-14s %8d %8ld %8.1f %8.3f %8ld %8.1f %8d\n", label, s->nworkers,
+            total.items, total.busy_ns / 1000000.0,
+            total.items ? total.busy_ns / 1000000.0 / total.items : 0.0,
+            total.stalls, total.stall_ns / 1000000.0, atomic_load(&s->max_depth));
+    }
+    stage_stat submit = {0};
+    for(int i=0; i<p->nsubmitters; i++) {
+        submit.stalls += p->submit[i].stalls;
+        submit.stall_ns += p->submit[i].stall_ns;
+    }
+    fprintf(fd, "    %-14s %8s %8s %8s %8s %8ld %8.1f\n", "Submit", "", "", "", "",
+        submit.stalls, submit.stall_ns / 1000000.0);
+}
+
+void pipeline_deinit(pipeline *p) {
+    for(int i=0; i<p->nstages; i++) {
+        lfring_deinit(&p->stages[i].queue);
+        free(p->stages[i].stats);
+        free(p->stages[i].threads);
+    }
+    free(p->stages);
+    free(p->submit);
+}
+
+// Worker thread task. Runs the stage function on each item taken from the
+// stage's queue and passes the item on, until the stage is closed and empty.
+static void * run_stage(void *arg) {
+    stage *s = ((stage_arg *)arg)->s;
+    int worker = ((stage_arg *)arg)->worker;
+    free(arg);
+    stage_stat *st = &s->stats[worker];
+    stage *next = (s->index + 1 < s->p->nstages) ? &s->p->stages[s->index + 1] : NULL;
+    work_item item;
+    while(get(s, &item)) {
+        int64_t begin = evlog_now();
+        s->fn(&item, s->index, s->first_id + worker);
+        st->busy_ns += evlog_now() - begin;
+        st->items += item.count;
+        if(next != NULL) {
+            put(next, &item, st);
+        }
+    }
+    // The last worker out closes the next stage
+    if(atomic_fetch_sub(&s->active, 1) == 1 && next != NULL) {
+        close_stage(next);
+    }
+    return NULL;
+}
+
+// Places an item on the stage's queue. A full queue counts as a stall and the
+// caller sleeps until a worker of the stage frees a slot.
+static void put(stage *s, work_item *item, stage_stat *st) {
+    if(!lfring_enqueue(*item, &s->queue)) {
+        int64_t begin = evlog_now();
+        st->stalls++;
+        while(true) {
+            unsigned key = evcount_prepare(&s->not_full);
+            if(lfring_enqueue(*item, &s->queue)) {
+                evcount_cancel(&s->not_full);
+                break;
+            }
+            evcount_wait(&s->not_full, key);
+        }
+        st->stall_ns += evlog_now() - begin;
+    }
+    int depth = lfring_count(&s->queue);
+    int max = atomic_load_explicit(&s->max_depth, memory_order_relaxed);
+    while(depth > max && !atomic_compare_exchange_weak(&s->max_depth, &max, depth));
+    evcount_notify(&s->not_empty, 1);
+}
+
+// Takes an item from the stage's queue, sleeping while it is empty. Returns
+// false once the stage is closed and nothing is left.
+static bool get(stage *s, work_item *item) {
+    while(true) {
+        if(lfring_dequeue(item, &s->queue)) {
+            evcount_notify(&s->not_full, 1);
+            return true;
+        }
+        unsigned key = evcount_prepare(&s->not_empty);
+        if(lfring_dequeue(item, &s->queue)) {
+            evcount_cancel(&s->not_empty);
+            evcount_notify(&s->not_full, 1);
+            return true;
+        }
+        if(atomic_load(&s->closed)) {
+            // Everything upstream was enqueued before the close
+            evcount_cancel(&s->not_empty);
+            return lfring_dequeue(item, &s->queue);
+        }
+        evcount_wait(&s->not_empty, key);
+    }
+}
+
+static void close_stage(stage *s) {
+    atomic_store(&s->closed, true);
+    evcount_notify_all(&s->not_empty);
+}
@@ -0,0 +1,67 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "evcount.h"
+#include "lfring.h"
+
+/*
+* Chain of stages, each with its own worker threads, bounded lock-free input
+* queue and per-item function. A worker hands every finished item to the next
+* stage's queue, waiting while that queue is full, so a slow stage pushes back
+* on the stages before it and finally on whoever submits. Closing the pipeline
+* drains it one stage at a time: the last worker of a stage to finish closes
+* the stage after it.
+*/
+typedef void (*stage_fn)(work_item *item, int stage, int id);
+
+// Per-worker counters, each written only by its own thread
+typedef struct {
+    _Alignas(CACHE_LINE) long items;
+    int64_t busy_ns;
+    long stalls;
+    int64_t stall_ns;
+} stage_stat;
+
+typedef struct stage {
+    const char *name;
+    stage_fn fn;
+    int index, nworkers, first_id;
+    lfring queue;
+    evcount not_empty, not_full;
+    atomic_bool closed;
+    atomic_int active;
+    atomic_int max_depth;
+    stage_stat *stats;
+    pthread_t *threads;
+    struct pipeline *p;
+} stage;
+
+typedef struct pipeline {
+    stage *stages;
+    int nstages;
+    // Counters for each thread submitting to the first stage
+    stage_stat *submit;
+    int nsubmitters;
+} pipeline;
+
+void pipeline_init(pipeline *p, int nstages, int nsubmitters);
+
+void pipeline_stage(pipeline *p, int i, const char *name, stage_fn fn, int nworkers,
+    int queue_size, int first_id);
+
+void pipeline_start(pipeline *p);
+
+void pipeline_submit(pipeline *p, int submitter, work_item item);
+
+void pipeline_close(pipeline *p);
+
+void pipeline_summary(FILE *fd, pipeline *p);
+
+void pipeline_deinit(pipeline *p);
+
+#endif
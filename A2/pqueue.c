@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "pqueue.h"
+
+static bool before(const pqueue_entry *a, const pqueue_entry *b);
+
+
+void pqueue_init(pqueue *q, int size) {
+    q->size = size;
+    q->entries = malloc(sizeof(pqueue_entry) * q->size);
+    if(q->entries == NULL) {
+        perror("Heap allocation failed");
+        exit(1);
+    }
+    q->count = 0;
+    q->seq = 0;
+}
+
+bool pqueue_empty(pqueue *q) {
+    return(q->count == 0);
+}
+
+bool pqueue_full(pqueue *q) {
+    return(q->count == q->size);
+}
+
+void pqueue_deinit(pqueue *q) {
+    free(q->entries);
+}
+
+// Places the entry at the end of the heap and sifts it up past larger parents
+bool pqueue_insert(work_item entry, int64_t key, pqueue *q) {
+    if(pqueue_full(q)) return false;
+    pqueue_entry e = {key, q->seq++, entry};
+    int i = q->count++;
+    while(i > 0 && before(&e, &q->entries[(i - 1) / 2])) {
+        q->entries[i] = q->entries[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    q->entries[i] = e;
+    return true;
+}
+
+// Takes the root and sifts the last entry down from the top into its place
+bool pqueue_remove(work_item *entry, pqueue *q) {
+    if(pqueue_empty(q)) return false;
+    *entry = q->entries[0].entry;
+    pqueue_entry last = q->entries[--q->count];
+    int i = 0;
+    while(true) {
+        int child = 2 * i + 1;
+        if(child >= q->count) break;
+        if(child + 1 < q->count && before(&q->entries[child + 1], &q->entries[child])) {
+            child++;
+        }
+        if(!before(&q->entries[child], &last)) break;
+        q->entries[i] = q->entries[child];
+        i = child;
+    }
+    q->entries[i] = last;
+    return true;
+}
+
+static bool before(const pqueue_entry *a, const pqueue_entry *b) {
+    return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
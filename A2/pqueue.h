@@ -0,0 +1,38 @@
+#ifndef __PQUEUE_H__
+#define __PQUEUE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fifo.h"
+
+/*
+* Bounded binary min-heap of work items. Each item is inserted with a key and
+* the item with the lowest key is removed first. Equal keys leave in insertion
+* order, so a constant key behaves as a FIFO.
+*/
+typedef struct {
+    int64_t key;
+    uint64_t seq;
+    work_item entry;
+} pqueue_entry;
+
+typedef struct {
+    pqueue_entry *entries;
+    uint64_t seq;
+    int count, size;
+} pqueue;
+
+void pqueue_init(pqueue *q, int size);
+
+bool pqueue_empty(pqueue *q);
+
+bool pqueue_full(pqueue *q);
+
+void pqueue_deinit(pqueue *q);
+
+bool pqueue_insert(work_item entry, int64_t key, pqueue *q);
+
+bool pqueue_remove(work_item *entry, pqueue *q);
+
+#endif
@@ -1,14 +1,42 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <pthread.h>
-#include <sys/time.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
 
 /* User defined headers */
+#include "binlog.h"
+#include "evcount.h"
+#include "evlog.h"
+#include "fiber.h"
 #include "fifo.h"
+#include "hist.h"
+#include "ingest.h"
+#include "kernel.h"
+#include "lfring.h"
+#include "lockstat.h"
+#include "perfctr.h"
+#include "pipeline.h"
+#include "pqueue.h"
+#include "sim.h"
+#include "topology.h"
+#include "trace.h"
+#include "wsdeque.h"
 #include "tands.h"
 
 /* User defined macros */
@@ -17,28 +45,245 @@
 #error "SYS_gettid unavailable on this system"
 #endif
 #define gettid() ((pid_t)syscall(SYS_gettid))
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
 
 /* User defines */
-#define LINE_LENGTH 100
+#define LINE_LENGTH INGEST_LINE
 #define PRODUCER_ID 0
+#define SPIN_LIMIT 64
+#define SPIN_MIN 16
+#define SPIN_MAX 1024
+#define MAX_RUN 16
+#define LOG_BUFFER_SIZE 4096
+#define POOL_SAMPLE_NS 10000000
+#define POOL_GROW_SAMPLES 3
+#define POOL_GROW_WAIT_NS 5000000
+#define POOL_COOLDOWN_NS 200000000
+#define AGING_WEIGHT 4
+#define MAX_PRODUCERS 64
+#define SLEEP_UNIT_NS 10000000
+#define FIBER_STACK_SIZE (64 * 1024)
+#define MAX_STAGES 16
+#define REPORT_UTIL_ROWS 16
+#define LOCK_TYPES 4
 
 /* Private function prototypes */
 static void check_input(char *in, char *c, int *n);
+static void * produce(void *arg);
+static int producer_slot(int index);
+static void run_command(char c, int n);
+static bool input_idle(FILE *in);
+static void replay_sleep(int n);
 static void * consume(void *arg);
-static void print_message(int msg, int val, int id);
+static void add_work(int n);
+static struct split_item * split_new(int n, int64_t now);
+static int split_chunk(struct split_item *s, int i);
+static int64_t complete(work_item *item, int id, int64_t received);
+static void flush_work();
+static void put_work(work_item *items, int n);
+static int get_work(int id, work_item *items);
+static bool queue_full();
+static bool queue_empty();
+static void queue_insert(work_item item);
+static int64_t queue_key(const work_item *item);
+static bool queue_remove(work_item *item);
+static int take_work(int id, work_item *items, int n);
+static int push_work(int id, work_item *items, int n);
+static int await(int (*attempt)(int, work_item *, int), int id, work_item *items, int n,
+    evcount *e, bool stop_at_end);
+static long context_switches();
+static void print_items(int msg, work_item *items, int n, int id, int depth);
+static void backoff(int *spins);
+static void * log_writer(void *arg);
+static void write_record(evlog_record *r);
+static void print_message(int msg, int val, int id, int depth);
+static void start_consumer(int slot);
+static bool retire_consumer();
+static int queue_depth();
+static void depth_change(int depth);
+static void depth_seen(int depth);
+static void print_depth();
+static void * pool_manager(void *arg);
+static void * fiber_thread(void *arg);
+static int fiber_idle(fiber_worker *w);
+static int parse_pipeline(char *spec);
+static void stage_kernel(work_item *item, int stage, int id);
+static void stage_sum(work_item *item, int stage, int id);
+static void stage_item(work_item *item, int stage, int id, bool aggregate);
+static void * reporter(void *arg);
+static void report(FILE *out, int64_t *last_ns, int64_t *busy, hist *prev);
+static void busy_until(int id, int64_t t, bool busy);
+static void perf_start(uint64_t *out);
+static void perf_stop(void *arg);
+static void pin_thread(int index);
+static int placement_cpu(int index);
+static void simulate_run(FILE *in);
+static void simulate_record(int msg, const work_item *item, int id, int64_t t);
+static int64_t run_ns();
 static void print_summary();
+static void print_latency(const char *title, int type);
+static void print_counters();
+static void print_placement();
+static void print_processes();
+static void print_locks();
+static int lock_mutex(pthread_mutex_t *m, int lock, int slot);
+static int unlock_mutex(pthread_mutex_t *m, int lock, int slot);
+static int wait_cond(pthread_cond_t *c, int cond, pthread_mutex_t *m, int lock, int slot);
+static void * map_segment(size_t bytes);
+static void consumer_exited(int sig);
+static int check_consumers(work_item *items, int n);
+
+/* User typedefs */
+typedef struct thread_stat {
+    _Alignas(CACHE_LINE) int msgs[MESSAGE_TYPES];
+    int stolen;
+    _Atomic int64_t recent_wait;
+    _Atomic int64_t busy_ns;
+    _Atomic int64_t busy_since;
+    long csw;
+    hist wait;
+    hist service;
+    hist response;
+    hist lag;
+    long aggregate;
+    uint64_t perf[PERFCTR_MAX];
+    int64_t queued_ns;
+    int64_t blocked_ns;
+    int splits;
+    int chunks;
+    lockstat locks[LOCK_TYPES];
+} thread_stat;
+
+// Time-weighted occupancy of the mutex queue, updated under count_mutex
+typedef struct depth_stat {
+    int depth;
+    int64_t last_ns;
+    int64_t area;
+    int64_t empty_ns;
+} depth_stat;
+
+// State the consumers share with the producers. Threads use local_state,
+// consumer processes find it at the start of a shared memory segment.
+typedef struct shared_state {
+    lfring lfqueue;
+    evcount work_ready, space_ready;
+    atomic_bool end_of_input;
+    atomic_int max_depth;
+    pthread_mutex_t print_mutex;
+} shared_state;
+
+// Shared by the chunks of a split work item. The chunk that takes remaining to
+// zero completes the item.
+typedef struct split_item {
+    atomic_int remaining;
+    int chunks;
+    int work;
+    int64_t split_ns;
+} split_item;
+
+typedef struct perf_thread {
+    perfctr ctr;
+    uint64_t *out;
+} perf_thread;
+
+typedef struct producer {
+    int index;
+    FILE *in;
+    long begin, end;
+} producer;
 
 /* Private global variables */
-static pthread_mutex_t count_mutex, print_mutex;
+static pthread_mutex_t count_mutex;
 static pthread_cond_t empty, full;
-static bool end_of_input = false;
 static fifo queue;
-static struct timeval start, end;
-static int msg_stats[6] = {0, 0, 0, 0, 0, 0};
-static int *thread_stats;
+static pqueue heap;
+// Entries on the mutex queue, kept for readers that do not hold count_mutex
+static atomic_int queued = 0;
+static int queue_size = 0;
+static int64_t trans_unit_ns = 0;
+static double replay_scale = 0;
+static _Thread_local int64_t schedule;
+static wsdeque *deques;
+static int next_deque = 0;
+static _Thread_local int spin_budget = SPIN_LIMIT;
+static _Thread_local work_item *pending;
+static _Thread_local int npending = 0;
+static int producer_batch = 1;
+static int consumer_batch = 1;
+static int coalesce_limit = 0;
+static bool fast_input = false;
+static int64_t start_ns;
+static evlog_buffer *log_buffers;
+static pthread_t writer;
+static atomic_bool log_done = false;
+static binlog blog;
+static thread_stat *thread_stats;
 static int nthreads;
+static int nslots;
+static int nproducers = 1;
+static char *inputs[MAX_PRODUCERS];
+static int ninputs = 0;
+static pthread_t *consumers;
+static int *ids;
+static atomic_int *slot_states;
+static int pool_min = 0, pool_max = 0;
+static int pool_peak = 0;
+static atomic_int pool_size = 0;
+static atomic_int retire_requests = 0;
+static atomic_bool pool_done = false;
+static pthread_t manager;
+static int nworkers = 0;
+static fiber_worker *workers;
+static long *worker_csw;
+static char *pipeline_spec = NULL;
+static pipeline chain;
+static kernel *stage_kernels[MAX_STAGES];
+static kernel *work_kernel = NULL;
+static _Thread_local int log_slot = -1;
+static int report_ms = -1;
+static char *report_path = NULL;
+static FILE *report_fd;
+static pthread_t report_thread;
+static atomic_bool report_done = false;
+static bool perf_counters = false;
+static pthread_key_t perf_key;
+static uint64_t (*worker_perf)[PERFCTR_MAX];
+static char *trace_path = NULL;
+static trace tracer;
+static depth_stat depth_stats;
+static char *pin_policy = NULL;
+static int pin_cpus[TOPOLOGY_MAX_CPUS];
+static int npin = 0;
+static _Thread_local bool pinned = false;
+static shared_state local_state = {.print_mutex = PTHREAD_MUTEX_INITIALIZER};
+static shared_state *shared = &local_state;
+static bool consumer_processes = false;
+static bool simulate = false;
+static int split_limit = 0;
+static bool lock_profile = false;
+static int64_t simulated_ns = 0;
+static int64_t simulate_wall_ns = 0;
+static pid_t *consumer_pids;
+static int *exit_status;
+static size_t segment_bytes;
 static FILE *fd;
-enum message {Ask, Receive, Work, Complete, Tands_Sleep, End};
+enum queue_type {Mutex_Queue, Lockfree_Queue, Steal_Queue};
+enum distribution {Round_Robin, Least_Loaded};
+enum log_type {Text_Log, Buffered_Log, Binary_Log};
+enum wait_type {Yield_Wait, Park_Wait};
+enum slot_state {Slot_Free, Slot_Running, Slot_Exited};
+enum lock_type {Count_Lock, Print_Lock, Empty_Wait, Full_Wait};
+enum policy {Fifo_Policy, Sjf_Policy, Aging_Policy};
+enum latency_type {Queue_Wait, Service_Time, Response_Time, Schedule_Lag};
+static enum queue_type queue_type = Mutex_Queue;
+static enum distribution distribution = Round_Robin;
+static enum log_type log_type = Text_Log;
+static enum wait_type wait_type = Park_Wait;
+static enum policy policy = Fifo_Policy;
 
 
 /*
@@ -49,10 +294,181 @@ enum message {Ask, Receive, Work, Complete, Tands_Sleep, End};
 int main(int argc, char *argv[]) {
 
   // Get program start time
-  if(gettimeofday(&start, NULL) != 0) {
-    perror("Get time of day failed");
-    exit(1);
+  start_ns = evlog_now();
+  depth_stats.last_ns = start_ns;
+
+  // Process command options
+  int opt;
+  while((opt = getopt(argc, argv, "q:d:b:k:c:l:fw:e:o:s:p:i:r:m:g:t:ux:j:a:nvz:y")) != -1) {
+    switch(opt) {
+    case 'q':
+      if(strcmp(optarg, "mutex") == 0) {
+        queue_type = Mutex_Queue;
+      } else if(strcmp(optarg, "lockfree") == 0) {
+        queue_type = Lockfree_Queue;
+      } else if(strcmp(optarg, "steal") == 0) {
+        queue_type = Steal_Queue;
+      } else {
+        printf("Error: Invalid queue type provided\n");
+        exit(1);
+      }
+      break;
+    case 'd':
+      if(strcmp(optarg, "rr") == 0) {
+        distribution = Round_Robin;
+      } else if(strcmp(optarg, "least") == 0) {
+        distribution = Least_Loaded;
+      } else {
+        printf("Error: Invalid distribution provided\n");
+        exit(1);
+      }
+      break;
+    case 'b':
+      if((producer_batch = atoi(optarg)) < 1) {
+        printf("Error: Invalid producer batch size provided\n");
+        exit(1);
+      }
+      break;
+    case 'k':
+      if((consumer_batch = atoi(optarg)) < 1) {
+        printf("Error: Invalid consumer batch size provided\n");
+        exit(1);
+      }
+      break;
+    case 'c':
+      if((coalesce_limit = atoi(optarg)) < 0) {
+        printf("Error: Invalid coalesce limit provided\n");
+        exit(1);
+      }
+      break;
+    case 'l':
+      if(strcmp(optarg, "text") == 0) {
+        log_type = Text_Log;
+      } else if(strcmp(optarg, "buffered") == 0) {
+        log_type = Buffered_Log;
+      } else if(strcmp(optarg, "binary") == 0) {
+        log_type = Binary_Log;
+      } else {
+        printf("Error: Invalid log type provided\n");
+        exit(1);
+      }
+      break;
+    case 'f':
+      fast_input = true;
+      break;
+    case 'w':
+      if(strcmp(optarg, "yield") == 0) {
+        wait_type = Yield_Wait;
+      } else if(strcmp(optarg, "park") == 0) {
+        wait_type = Park_Wait;
+      } else {
+        printf("Error: Invalid wait type provided\n");
+        exit(1);
+      }
+      break;
+    case 'e':
+      if(sscanf(optarg, "%d:%d", &pool_min, &pool_max) != 2 || pool_min < 1 ||
+          pool_max < pool_min) {
+        printf("Error: Invalid pool bounds provided\n");
+        exit(1);
+      }
+      break;
+    case 'o':
+      if(strcmp(optarg, "fifo") == 0) {
+        policy = Fifo_Policy;
+      } else if(strcmp(optarg, "sjf") == 0) {
+        policy = Sjf_Policy;
+      } else if(strcmp(optarg, "aging") == 0) {
+        policy = Aging_Policy;
+      } else {
+        printf("Error: Invalid queue policy provided\n");
+        exit(1);
+      }
+      break;
+    case 's':
+      if((queue_size = atoi(optarg)) < 1) {
+        printf("Error: Invalid queue size provided\n");
+        exit(1);
+      }
+      break;
+    case 'p':
+      if((nproducers = atoi(optarg)) < 1 || nproducers > MAX_PRODUCERS) {
+        printf("Error: Invalid producer count provided\n");
+        exit(1);
+      }
+      break;
+    case 'i':
+      if(ninputs == MAX_PRODUCERS) {
+        printf("Error: Too many input files provided\n");
+        exit(1);
+      }
+      inputs[ninputs++] = optarg;
+      break;
+    case 'r':
+      if((replay_scale = atof(optarg)) <= 0) {
+        printf("Error: Invalid replay scale provided\n");
+        exit(1);
+      }
+      break;
+    case 'm':
+      if((nworkers = atoi(optarg)) < 1) {
+        printf("Error: Invalid worker count provided\n");
+        exit(1);
+      }
+      break;
+    case 'g':
+      pipeline_spec = strdup(optarg);
+      break;
+    case 't':
+      if(sscanf(optarg, "%d", &report_ms) != 1 || report_ms < 0) {
+        printf("Error: Invalid report interval provided\n");
+        exit(1);
+      }
+      if((report_path = strchr(optarg, ':')) != NULL) {
+        report_path++;
+      }
+      break;
+    case 'u':
+      perf_counters = true;
+      break;
+    case 'x':
+      if((work_kernel = kernel_find(optarg)) == NULL) {
+        printf("Error: Invalid kernel provided\n");
+        exit(1);
+      }
+      break;
+    case 'j':
+      trace_path = optarg;
+      break;
+    case 'a':
+      pin_policy = optarg;
+      if((npin = topology_order(pin_policy, pin_cpus, TOPOLOGY_MAX_CPUS)) < 0) {
+        printf("Error: Invalid CPU placement provided\n");
+        exit(1);
+      }
+      break;
+    case 'n':
+      consumer_processes = true;
+      break;
+    case 'v':
+      simulate = true;
+      break;
+    case 'z':
+      if((split_limit = atoi(optarg)) < 1) {
+        printf("Error: Invalid split limit provided\n");
+        exit(1);
+      }
+      break;
+    case 'y':
+      lock_profile = true;
+      break;
+    default:
+      printf("Usage: prodcon [-q mutex|lockfree|steal] [-d rr|least] [-b batch] [-k batch] [-c limit] [-l text|buffered|binary] [-f] [-w yield|park] [-e min:max] [-o fifo|sjf|aging] [-s size] [-p producers] [-i file]... [-r scale] [-m workers] [-g stage,...] [-t ms[:file]] [-u] [-x trans|hash|sort|stream] [-j trace.json] [-a compact|scatter|cpu,...] [-n] [-v] [-z limit] [-y] nthreads [id]\n");
+      exit(1);
+    }
   }
+  argc -= optind - 1;
+  argv += optind - 1;
 
   // Process command arguments
   if(argc < 2) {
@@ -60,97 +476,449 @@ int main(int argc, char *argv[]) {
     exit(1);
   }
   nthreads = atoi(argv[1]);
+  int initial = nthreads;
+  if(work_kernel == NULL) {
+    work_kernel = kernel_find("trans");
+  }
+  if(policy != Fifo_Policy && queue_type != Mutex_Queue) {
+    // The lock-free queues are FIFO by construction
+    printf("Error: Queue policy requires the mutex queue\n");
+    exit(1);
+  }
+  if(pool_max > 0) {
+    // Elastic pool: consumer slots are sized for the upper bound and the
+    // starting count is clamped into range
+    if(queue_type == Steal_Queue) {
+      printf("Error: Elastic pool requires the mutex or lockfree queue\n");
+      exit(1);
+    }
+    initial = initial < pool_min ? pool_min : initial > pool_max ? pool_max : initial;
+    nthreads = pool_max;
+  }
+  if(nworkers > 0 && (queue_type != Lockfree_Queue || pool_max > 0)) {
+    // Fibers wait by parking on their worker, which only the lock-free ring's
+    // non-blocking take supports
+    printf("Error: Fiber consumers require the lockfree queue and a fixed pool\n");
+    exit(1);
+  }
+  if(pipeline_spec != NULL) {
+    // Stage workers replace the consumers and take the consumer ids in order
+    if(pool_max > 0 || nworkers > 0) {
+      printf("Error: Pipeline stages have fixed thread pools\n");
+      exit(1);
+    }
+    if(queue_type != Mutex_Queue || policy != Fifo_Policy) {
+      // Each stage has its own ring, so there is no work queue to choose
+      printf("Error: Pipeline stages use their own queues\n");
+      exit(1);
+    }
+    nthreads = initial = parse_pipeline(pipeline_spec);
+  }
+  if(nproducers > 1 && queue_type == Steal_Queue) {
+    // Each deque has a single owner pushing to it
+    printf("Error: Steal queue supports a single producer\n");
+    exit(1);
+  }
+  if(ninputs > 1 && ninputs != nproducers) {
+    printf("Error: Provide one input file per producer or one to shard\n");
+    exit(1);
+  }
+  if(consumer_processes && (queue_type != Lockfree_Queue || log_type != Text_Log ||
+      pool_max > 0 || nworkers > 0 || pipeline_spec != NULL || trace_path != NULL)) {
+    // Only the ring and the text log work across address spaces
+    printf("Error: Consumer processes require the lockfree queue, the text log and a fixed pool\n");
+    exit(1);
+  }
+  if(split_limit > 0 && (pipeline_spec != NULL || consumer_processes)) {
+    // Chunks share their item's completion count in this process's memory
+    printf("Error: Splitting is not available with pipeline stages or consumer processes\n");
+    exit(1);
+  }
+  if(simulate && (queue_type != Mutex_Queue || log_type != Text_Log || nproducers > 1 ||
+      ninputs > 1 || pool_max > 0 || nworkers > 0 || pipeline_spec != NULL ||
+      replay_scale > 0 || report_ms >= 0 || perf_counters || trace_path != NULL ||
+      consumer_processes || producer_batch > 1 || consumer_batch > 1 ||
+      coalesce_limit > 0 || fast_input || distribution != Round_Robin ||
+      wait_type != Park_Wait || pin_policy != NULL || lock_profile)) {
+    printf("Error: Simulation models one producer, the mutex queue and a fixed pool\n");
+    exit(1);
+  }
+  if(report_ms >= 0) {
+    // SIGUSR1 is blocked before any thread starts, so every thread inherits
+    // the mask and the reporter is the only one to take it, with sigtimedwait
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    if(pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) {
+      printf("Error: Could not block SIGUSR1\n");
+      exit(1);
+    }
+    report_fd = stdout;
+    if(report_path != NULL && (report_fd = fopen(report_path, "w")) == NULL) {
+      perror("Could not open report file");
+      exit(1);
+    }
+  }
+  if(perf_counters) {
+    // Counters are read and closed by the key's destructor as each thread exits
+    if(!perfctr_probe()) {
+      printf("Error: Performance counters unavailable\n");
+      exit(1);
+    }
+    pthread_key_create(&perf_key, perf_stop);
+  }
   char filenum[100];
   char *filename = malloc(sizeof(char) * 100);
-  thread_stats = malloc(sizeof(int) * nthreads);
-  memset(thread_stats, 0, sizeof(int) * nthreads);
+  // Statistics are kept per thread slot, each on its own cache lines, so every
+  // thread only ever writes its own entry. The first producer is slot 0, the
+  // pool manager takes the slot after the last consumer and further producers
+  // follow it.
+  nslots = nthreads + 1 + nproducers;
+  if(queue_size == 0) {
+    queue_size = nthreads * 2;
+  }
+  if(consumer_processes) {
+    // The shared state, the statistics and the ring slots share one segment,
+    // each part starting on a cache line
+    segment_bytes = sizeof(shared_state) + sizeof(thread_stat) * nslots +
+        lfring_bytes(queue_size);
+    shared = map_segment(segment_bytes);
+    thread_stats = (thread_stat *)(shared + 1);
+  } else {
+    thread_stats = aligned_alloc(CACHE_LINE, sizeof(thread_stat) * nslots);
+  }
+  if(thread_stats == NULL) {
+    perror("Statistics allocation failed");
+    exit(1);
+  }
+  memset(thread_stats, 0, sizeof(thread_stat) * nslots);
 
   // Create file output
-  strcat(filename, "prodcon.");
+  strcpy(filename, "prodcon.");
   if(argc > 2) {
     sprintf(filenum, "%d", atoi(argv[2]));
     strcat(filename, filenum);
     strcat(filename, ".");
   }
-  strcat(filename, "log");
-  fd = fopen(filename, "w+");
-  if(fd == NULL) {
-    perror("Could not open output file");
-    exit(1);
+  if(log_type == Binary_Log) {
+    // Rendered as text later by prodcon-logdump
+    strcat(filename, "blog");
+    binlog_open(&blog, filename, nthreads, nslots);
+  } else {
+    strcat(filename, "log");
+    fd = fopen(filename, "w+");
+    if(fd == NULL) {
+      perror("Could not open output file");
+      exit(1);
+    }
+  }
+
+  if(simulate) {
+    // Nothing is started, the run is modelled from the trace in virtual time
+    FILE *in = stdin;
+    if(ninputs == 1 && (in = fopen(inputs[0], "r")) == NULL) {
+      perror("Could not open input file");
+      exit(1);
+    }
+    trans_unit_ns = work_kernel->unit_ns;
+    simulate_run(in);
+    if(in != stdin) {
+      fclose(in);
+    }
+    print_summary();
+    fclose(fd);
+    free(filename);
+    free(thread_stats);
+    return 0;
+  }
+
+  // Create the trace with a track per producer and consumer, named as in the log
+  if(trace_path != NULL) {
+    char name[32];
+    trace_open(&tracer, trace_path, start_ns);
+    for(int i=0; i<nproducers; i++) {
+      snprintf(name, sizeof(name), nproducers > 1 ? "Producer %d" : "Producer", i);
+      trace_track(&tracer, producer_slot(i), name);
+    }
+    for(int i=1; i<=nthreads; i++) {
+      snprintf(name, sizeof(name), "Thread %d", i);
+      trace_track(&tracer, i, name);
+    }
+  }
+
+  // Create per-thread event buffers and the log writer, indexed by thread slot
+  if(log_type == Buffered_Log) {
+    log_buffers = malloc(sizeof(evlog_buffer) * nslots);
+    for(int i=0; i<nslots; i++) {
+      evlog_init(&log_buffers[i], LOG_BUFFER_SIZE);
+    }
+    pthread_create(&writer, NULL, &log_writer, NULL);
   }
 
   // Create work queue and consumer threads
-  int queue_size = nthreads * 2;
-  fifo_init(&queue, queue_size);
-  pthread_t consumers[nthreads];
-  int ids[nthreads];
+  if(policy != Fifo_Policy) {
+    trans_unit_ns = work_kernel->unit_ns;
+  }
+  if(consumer_processes) {
+    // Waiters and the log lock are seen from every process
+    evcount_init_shared(&shared->work_ready);
+    evcount_init_shared(&shared->space_ready);
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    if(pthread_mutex_init(&shared->print_mutex, &attr) != 0) {
+      printf("Error: Could not create shared mutex\n");
+      exit(1);
+    }
+    pthread_mutexattr_destroy(&attr);
+    lfring_init_at(&shared->lfqueue, queue_size, &thread_stats[nslots]);
+  } else {
+    evcount_init(&shared->work_ready);
+    evcount_init(&shared->space_ready);
+  }
+  if(consumer_processes) {
+    consumer_pids = malloc(sizeof(pid_t) * nthreads);
+    exit_status = malloc(sizeof(int) * nthreads);
+    // A producer waiting for space rechecks the consumers when one exits
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = consumer_exited;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if(sigaction(SIGCHLD, &action, NULL) != 0) {
+      perror("Signal handler error");
+      exit(1);
+    }
+  } else if(queue_type == Lockfree_Queue) {
+    lfring_init(&shared->lfqueue, queue_size);
+  } else if(queue_type == Steal_Queue) {
+    // Split the queue capacity between the consumers
+    deques = malloc(sizeof(wsdeque) * nthreads);
+    for(int i=0; i<nthreads; i++) {
+      wsdeque_init(&deques[i], queue_size / nthreads);
+    }
+  } else if(policy != Fifo_Policy) {
+    pqueue_init(&heap, queue_size);
+  } else {
+    fifo_init(&queue, queue_size);
+  }
+  consumers = malloc(sizeof(pthread_t) * nthreads);
+  ids = malloc(sizeof(int) * nthreads);
+  slot_states = malloc(sizeof(atomic_int) * nthreads);
   for(int i=0; i<nthreads; i++) {
     ids[i] = i+1;
-    pthread_create(&consumers[i], NULL, &consume, (void *)&ids[i]);
+    atomic_init(&slot_states[i], Slot_Free);
+  }
+  // Fiber consumers are dealt out to the workers in turn
+  fiber *fibers = NULL;
+  pthread_t worker_threads[nworkers];
+  if(nworkers > 0) {
+    fibers = malloc(sizeof(fiber) * nthreads);
+    workers = malloc(sizeof(fiber_worker) * nworkers);
+    worker_csw = calloc(nworkers, sizeof(long));
+    worker_perf = calloc(nworkers, sizeof(*worker_perf));
+    for(int i=0; i<nworkers; i++) {
+      fiber_worker_init(&workers[i], fiber_idle);
+    }
+    for(int i=0; i<nthreads; i++) {
+      fiber_spawn(&workers[i % nworkers], &fibers[i], &consume, (void *)&ids[i],
+          FIBER_STACK_SIZE);
+    }
+    for(int i=0; i<nworkers; i++) {
+      pthread_create(&worker_threads[i], NULL, &fiber_thread, (void *)(intptr_t)i);
+    }
+  }
+  for(int i=0; i<initial && nworkers == 0 && pipeline_spec == NULL; i++) {
+    start_consumer(i);
+  }
+  if(pipeline_spec != NULL) {
+    pipeline_start(&chain);
+  }
+  if(pool_max > 0) {
+    pthread_create(&manager, NULL, &pool_manager, NULL);
+  }
+  if(report_ms >= 0) {
+    pthread_create(&report_thread, NULL, &reporter, NULL);
   }
   
   /*
-  * Read input and execute commands. This is the producer thread task. The producer
-  * reads commands and either Sleeps or adds a work item to the work queue. The work
-  * queue is provided with mutual exclusion.
+  * Assign the producers their input. With one input per producer each reads
+  * its own file. Otherwise the one input, stdin by default, is split into
+  * equal byte ranges and every producer opens it separately so each has its
+  * own file offset.
   */
-  char in[LINE_LENGTH];
-  char c;
-  int n;
-  while(fgets(in, LINE_LENGTH, stdin) != NULL) {
-    c = in[0];
-    check_input(in, &c, &n);
-    if(c == 'S') {  
-      print_message(Tands_Sleep, n, PRODUCER_ID);
-      Sleep(n);
-    } else if(c == 'T') {
-      if(pthread_mutex_lock(&count_mutex) != 0) {
-        perror("Mutex lock error");
-        exit(1);
-      }
-      while(fifo_full(&queue)) {
-        // Cannot add work until a consumer finishes some existing work
-        if(pthread_cond_wait(&empty, &count_mutex) != 0) {
-          perror("Condition wait error");
-          exit(1);
-        }
-      }
-      // Add work to FIFO
-      print_message(Work, n, PRODUCER_ID);
-      enqueue(n, &queue);
-      // Notify consumers of available work      
-      if(pthread_cond_broadcast(&full) != 0) {
-        perror("Condition broadcast error");
-        exit(1);
-      }
-      if(pthread_mutex_unlock(&count_mutex) != 0) {
-        perror("Mutex unlock error");
-        exit(1);
-      }      
+  producer producers[nproducers];
+  long length = -1;
+  if(nproducers > 1 && ninputs <= 1) {
+    struct stat st;
+    if((ninputs == 1 ? stat(inputs[0], &st) : fstat(STDIN_FILENO, &st)) != 0) {
+      perror("Could not stat input");
+      exit(1);
+    }
+    if(!S_ISREG(st.st_mode)) {
+      printf("Error: Input shards need a regular file\n");
+      exit(1);
     }
+    length = st.st_size;
   }
-  print_message(End, 0, 0);
-  end_of_input = true;
-  // Program input has ended, notify consumer threads
-  if(pthread_cond_signal(&full) != 0) {
-    perror("Condition signal error");
-    exit(1);
+  for(int i=0; i<nproducers; i++) {
+    producers[i].index = i;
+    producers[i].begin = 0;
+    producers[i].end = -1;
+    if(length >= 0) {
+      producers[i].begin = length * i / nproducers;
+      producers[i].end = length * (i + 1) / nproducers;
+    }
+    if(ninputs == 0 && nproducers == 1) {
+      producers[i].in = stdin;
+    } else if((producers[i].in = fopen(ninputs > 1 ? inputs[i] :
+        ninputs == 1 ? inputs[0] : "/dev/stdin", "r")) == NULL) {
+      perror("Could not open input file");
+      exit(1);
+    }
+  }
+  // The first producer runs on the main thread
+  pthread_t producer_threads[nproducers];
+  for(int i=1; i<nproducers; i++) {
+    pthread_create(&producer_threads[i], NULL, &produce, (void *)&producers[i]);
+  }
+  produce(&producers[0]);
+  for(int i=1; i<nproducers; i++) {
+    if(pthread_join(producer_threads[i], NULL) != 0) {
+      printf("Pthread join failed\n");
+      exit(1);
+    }
+  }
+  for(int i=0; i<nproducers; i++) {
+    if(producers[i].in != stdin) {
+      fclose(producers[i].in);
+    }
+  }
+  print_message(End, 0, 0, 0);
+  // Program input has ended, wake every consumer so each can drain and exit
+  if(pipeline_spec != NULL) {
+    pipeline_close(&chain);
+  } else if(queue_type != Mutex_Queue) {
+    atomic_store(&shared->end_of_input, true);
+    evcount_notify_all(&shared->work_ready);
+  } else {
+    if(lock_mutex(&count_mutex, Count_Lock, PRODUCER_ID) != 0) {
+      perror("Mutex lock error");
+      exit(1);
+    }
+    shared->end_of_input = true;
+    if(pthread_cond_broadcast(&full) != 0) {
+      perror("Condition broadcast error");
+      exit(1);
+    }
+    if(unlock_mutex(&count_mutex, Count_Lock, PRODUCER_ID) != 0) {
+      perror("Mutex unlock error");
+      exit(1);
+    }
+  }
+  // Stop resizing, then wait for consumer threads to complete their work before
+  // ending program
+  if(pool_max > 0) {
+    atomic_store(&pool_done, true);
+    if(pthread_join(manager, NULL) != 0) {
+      printf("Pthread join failed\n");
+      exit(1);
+    }
   }
-  // Wait for consumer threads to complete their work before ending program
   int status;
-  for (int i=0; i<nthreads; i++) {
+  for(int i=0; i<nworkers; i++) {
+    if(pthread_join(worker_threads[i], NULL) != 0) {
+      printf("Pthread join failed\n");
+      exit(1);
+    }
+  }
+  for (int i=0; i<nthreads && consumer_processes; i++) {
+    // A crashed consumer only loses the items it held, as long as another
+    // consumer is left to drain the ring
+    if(waitpid(consumer_pids[i], &exit_status[i], 0) < 0) {
+      perror("Wait failed");
+      exit(1);
+    }
+  }
+  for (int i=0; i<nthreads && !consumer_processes; i++) {
+    if(atomic_load(&slot_states[i]) == Slot_Free) continue;
     status = pthread_join(consumers[i], NULL);
     if (status != 0) {
       printf("Pthread join failed\n");
       exit(1);
     }
   }
-  print_summary();
+  if(report_ms >= 0) {
+    // Wake the reporter from its wait so it sees the flag
+    atomic_store(&report_done, true);
+    pthread_kill(report_thread, SIGUSR1);
+    if(pthread_join(report_thread, NULL) != 0) {
+      printf("Pthread join failed\n");
+      exit(1);
+    }
+    if(report_fd != stdout) {
+      fclose(report_fd);
+    }
+  }
+  if(log_type == Buffered_Log) {
+    // Let the writer drain what is left and stop
+    atomic_store(&log_done, true);
+    if(pthread_join(writer, NULL) != 0) {
+      printf("Pthread join failed\n");
+      exit(1);
+    }
+    for(int i=0; i<nslots; i++) {
+      evlog_deinit(&log_buffers[i]);
+    }
+    free(log_buffers);
+  }
+  if(trace_path != NULL) {
+    trace_close(&tracer);
+  }
+  if(log_type == Binary_Log) {
+    binlog_close(&blog, evlog_now() - start_ns);
+  } else {
+    print_summary();
+    fclose(fd);
+  }
   // Deallocate memory from heap
-  fifo_deinit(&queue);
+  if(consumer_processes) {
+    munmap(shared, segment_bytes);
+    free(consumer_pids);
+    free(exit_status);
+  } else if(queue_type == Lockfree_Queue) {
+    lfring_deinit(&shared->lfqueue);
+  } else if(queue_type == Steal_Queue) {
+    for(int i=0; i<nthreads; i++) {
+      wsdeque_deinit(&deques[i]);
+    }
+    free(deques);
+  } else if(policy != Fifo_Policy) {
+    pqueue_deinit(&heap);
+  } else {
+    fifo_deinit(&queue);
+  }
+  if(nworkers > 0) {
+    for(int i=0; i<nthreads; i++) {
+      fiber_deinit(&fibers[i]);
+    }
+    free(fibers);
+    free(workers);
+    free(worker_csw);
+    free(worker_perf);
+  }
+  if(pipeline_spec != NULL) {
+    pipeline_deinit(&chain);
+    free(pipeline_spec);
+  }
   free(filename);
-  free(thread_stats);
-  fclose(fd);
+  free(consumers);
+  free(ids);
+  free(slot_states);
+  if(!consumer_processes) {
+    free(thread_stats);
+  }
   return 0;
 }
 
@@ -180,195 +948,1862 @@ void check_input(char *in, char *c, int *n) {
 
 
 /*
-* Consumer thread task
+* Producer thread task
 *
-* Reads from the work FIFO as work becomes available. The FIFO is provided
-* with mutual exclusion using the count_mutex. When the EOF has been detected
-* from the program input, each thread will exit when all of the work has been 
-* completed.
+* Reads the producer's input and executes its commands, either Sleeping or
+* adding a work item to the work queue. A Sleep only pauses this producer.
+* When a byte range is set, only the lines starting inside it are read.
 */
-void * consume(void *arg) {
-  int *id = (int *)arg;
-  while(true) {
-    // Ask for work
-    print_message(Ask, 0, *id);
-    if(pthread_mutex_lock(&count_mutex) != 0) {
-      perror("Mutex lock error");
-      exit(1);
+void * produce(void *arg) {
+  producer *p = (producer *)arg;
+  int slot = producer_slot(p->index);
+  log_slot = slot;
+  pin_thread(p->index);
+  schedule = evlog_now();
+  pending = malloc(sizeof(work_item) * producer_batch);
+  char c;
+  int n;
+  if(fast_input) {
+    ingest input;
+    ingest_open_range(&input, fileno(p->in), p->begin, p->end);
+    // Publish held work rather than hold it while waiting on a pipe
+    input.before_wait = flush_work;
+    while(ingest_next(&input, &c, &n)) {
+      run_command(c, n);
     }
-    while(fifo_empty(&queue)) {
-      if(end_of_input) {
-        // EOF detected, and no remaining work. Thread can exit.
-        if(pthread_mutex_unlock(&count_mutex) != 0) {
-          perror("Mutex unlock error");
-          exit(1);
-        }
-        if(pthread_cond_signal(&full) != 0) {
-          perror("Condition signal error");
-          exit(1);
-        }
-        pthread_exit(NULL);
+    ingest_close(&input);
+  } else {
+    char in[LINE_LENGTH];
+    if(p->begin > 0) {
+      // Skip the line that the previous shard finishes
+      int ch;
+      fseek(p->in, p->begin - 1, SEEK_SET);
+      while((ch = getc(p->in)) != EOF && ch != '\n');
+    }
+    struct stat st;
+    bool may_wait = fstat(fileno(p->in), &st) == 0 && !S_ISREG(st.st_mode);
+    while(true) {
+      // Publish held work rather than hold it while waiting on a pipe
+      if(may_wait && npending > 0 && input_idle(p->in)) {
+        flush_work();
       }
-      if(pthread_cond_wait(&full, &count_mutex) != 0) {
-        perror("Condition wait error");
-        exit(1);
+      if((p->end >= 0 && ftell(p->in) >= p->end) || fgets(in, LINE_LENGTH, p->in) == NULL) {
+        break;
       }
+      c = in[0];
+      check_input(in, &c, &n);
+      run_command(c, n);
     }
-    // Receive work
-    int work = dequeue(&queue);
-    print_message(Receive, work, *id);
-    if(pthread_cond_signal(&empty) != 0) {
-      perror("Condition signal error");
-      exit(1);
-    }
-    if(pthread_mutex_unlock(&count_mutex) != 0) {
-      perror("Mutex unlock error");
-      exit(1);
-    }
-    // Complete work
-    Trans(work);
-    print_message(Complete, work, *id);
   }
+  flush_work();
+  free(pending);
+  thread_stats[slot].csw = context_switches();
+  return NULL;
 }
 
 
 /*
-* Print summary
+* Input idle
 *
-* Print a status message to file output along with calling thread id and work value.
-* This function is provided mutual exclusion since the file descriptor is written to
-* by multiple threads, as well as the end variable used for calculating current_time.
+* Whether the stream's descriptor has nothing to read right now. Lines already
+* in the stream's buffer are not seen, so held work may be published a little
+* early, but never held while the producer waits for input.
 */
-void print_message(int msg, int n, int id) {
-  if(pthread_mutex_lock(&print_mutex) != 0) {
-    perror("Mutex lock error");
-    exit(1);
-  }
-  // Check if msg is valid
-  if(msg != Ask && msg != Receive && msg != Work && msg != Complete && msg != Tands_Sleep && msg != End) {
-    printf("Error: Invalid message type");
-    if(pthread_mutex_unlock(&print_mutex) != 0) {
-      perror("Mutex unlock error");
-      exit(1);
+bool input_idle(FILE *in) {
+  struct pollfd fds = {fileno(in), POLLIN, 0};
+  return poll(&fds, 1, 0) == 0;
+}
+
+
+/*
+* Producer slot
+*
+* Returns the statistics and log slot of the given producer
+*/
+int producer_slot(int index) {
+  return (index == 0) ? PRODUCER_ID : nthreads + 1 + index;
+}
+
+
+/*
+* Run command
+*
+* Either Sleeps or adds a work item to the work queue
+*/
+void run_command(char c, int n) {
+  if(c == 'S') {
+    // Publish held work before pausing so consumers are not left idle
+    flush_work();
+    print_message(Tands_Sleep, n, PRODUCER_ID, 0);
+    int64_t begin = evlog_now();
+    if(replay_scale > 0) {
+      replay_sleep(n);
+    } else {
+      Sleep(n);
     }
-    return;
-  }
-  // Update msg_stats[] and thread_stats[]
-  msg_stats[msg] += 1;
-  if(msg == Complete && id != 0) {
-    thread_stats[id-1] += 1;
+    if(trace_path != NULL) {
+      trace_slice(&tracer, log_slot < 0 ? PRODUCER_ID : log_slot, "Sleep", begin,
+          evlog_now(), n);
+    }
+  } else if(c == 'T') {
+    add_work(n);
   }
-  // Get total elapsed time
-  if(gettimeofday(&end, NULL) != 0) {
-    perror("Get time of day failure");
-    exit(1);
+}
+
+
+/*
+* Replay sleep
+*
+* Advances the calling producer's schedule by the Sleep time divided by
+* replay_scale and waits until that absolute time. Time spent parsing input or
+* blocked on a full queue is taken out of the next pause instead of adding to
+* it, so the trace's arrival times are kept. Records how late the producer
+* resumed against its schedule.
+*/
+void replay_sleep(int n) {
+  // Same range as Sleep
+  if(n <= 0 || n >= 100) {
+    n = 1;
   }
-  double current_time = (end.tv_sec - start.tv_sec) +
-        ((end.tv_usec - start.tv_usec) / 1000000.0);
-  // Write to file
-  fprintf(fd, "   %.3f", current_time);
-  fprintf(fd, " ID= %d", id);
-  switch(msg) {
-  case Ask:
-    fprintf(fd, "      Ask\n");
-    break;
-  case Receive:
-    fprintf(fd, " Q= 0 Receive      %d\n", n); 
-    break;
-  case Work:
-    fprintf(fd, " Q= 0 Work         %d\n", n); 
-    break;
-  case Complete:
-    fprintf(fd, "      Complete     %d\n", n);
-    break;
-  case Tands_Sleep:
-    fprintf(fd, "      Sleep        %d\n", n);
-    break;
-  case End:
-    fprintf(fd, "      End\n");
-    break;
-  default:
-    fprintf(fd, "Called print_message with msg = %d\n", msg);
-  }
-  if(pthread_mutex_unlock(&print_mutex) != 0){
-    perror("Mutex unlock error");
+  schedule += (int64_t)(n * SLEEP_UNIT_NS / replay_scale);
+  struct timespec deadline = {schedule / 1000000000, schedule % 1000000000};
+  int err;
+  while((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)) == EINTR);
+  if(err != 0) {
+    errno = err;
+    perror("Clock sleep failed");
     exit(1);
   }
+  hist_record(&thread_stats[log_slot].lag, evlog_now() - schedule, 1);
 }
 
 
 /*
-* Print summary
+* Consumer thread task
 *
-* Print the contents of msg_stats[] and thread_stats[] to file output
+* Takes up to consumer_batch work items from the work queue as they become
+* available. When the EOF has been detected from the program input, each thread
+* will exit when all of the work has been completed.
 */
-void print_summary() {
-  if(gettimeofday(&end, NULL) != 0) {
-    perror("Get time of day failed");
+void * consume(void *arg) {
+  int *id = (int *)arg;
+  thread_stat *stats = &thread_stats[*id];
+  // The batch lives on the heap, as -k is unbounded and a fiber's stack is small
+  work_item *items = malloc(sizeof(work_item) * consumer_batch);
+  if(items == NULL) {
+    perror("Batch allocation failed");
     exit(1);
   }
-  // Get total elapsed time
-  double current_time = (end.tv_sec - start.tv_sec) +
-        ((end.tv_usec - start.tv_usec) / 1000000.0);
-  // Write to file
-  fprintf(fd, "Summary:\n");
-  if(msg_stats[Work] > 999) {
-    fprintf(fd, "    Work       %d\n", msg_stats[Work]);
-  } else if (msg_stats[Work] > 99) {
-    fprintf(fd, "    Work        %d\n", msg_stats[Work]);
-  } else if (msg_stats[Work] > 9) {
-    fprintf(fd, "    Work         %d\n", msg_stats[Work]);
+  // Fibers share their worker's counters and CPU
+  if(fiber_current() == NULL) {
+    perf_start(stats->perf);
+    pin_thread(nproducers + *id - 1);
+  }
+  while(true) {
+    // Ask for work
+    print_message(Ask, 0, *id, 0);
+    int64_t asked = evlog_now();
+    int n = get_work(*id, items);
+    if(n <= 0) {
+      // EOF detected and no remaining work, or retired by the pool manager.
+      // Thread can exit. A retired slot may be reused, so counts accumulate.
+      // A fiber returns to its worker, which keeps the thread's count.
+      free(items);
+      if(fiber_current() != NULL) {
+        return NULL;
+      }
+      stats->csw += context_switches();
+      atomic_store(&slot_states[*id-1], Slot_Exited);
+      pthread_exit(NULL);
+    }
+    // Queue wait runs from Work to Receive, service time from Receive to
+    // Complete and response time from Work to Complete, for every item
+    // coalesced into each entry
+    int64_t received = evlog_now();
+    for(int i=0; i<n; i++) {
+      hist_record(&stats->wait, received - items[i].enq_ns, items[i].count);
+      stats->queued_ns += received - items[i].enq_ns;
+    }
+    if(trace_path != NULL) {
+      trace_slice(&tracer, *id, "Idle", asked, received, 0);
+    }
+    if(pool_max > 0) {
+      atomic_store_explicit(&stats->recent_wait, received - items[0].enq_ns,
+          memory_order_relaxed);
+    }
+    int64_t begin = received;
+    atomic_store(&stats->busy_since, received);
+    for(int i=0; i<n; i++) {
+      for(int j=0; j<items[i].count; j++) {
+        kernel_run(work_kernel, items[i].work);
+        int64_t completed = complete(&items[i], *id, received);
+        busy_until(*id, completed, true);
+        if(trace_path != NULL) {
+          trace_slice(&tracer, *id, "Work", begin, completed, items[i].work);
+        }
+        begin = completed;
+      }
+    }
+    busy_until(*id, evlog_now(), false);
+    // Let the worker's other fibers take a turn between batches
+    if(fiber_current() != NULL) {
+      fiber_yield();
+    }
+  }
+}
+
+
+/*
+* Add work
+*
+* Holds a work item until producer_batch entries are pending. When coalescing is
+* enabled, a run of identical items no larger than coalesce_limit is merged into
+* one entry of up to MAX_RUN items, and the batch is only published once an item
+* arrives that cannot be merged, a Sleep comes, or the input runs dry. An entry
+* holds one work value, so items of different sizes are never merged. With splitting enabled, an item above
+* split_limit is instead held as its chunks, each a separate entry.
+*/
+void add_work(int n) {
+  if(split_limit > 0 && n > split_limit) {
+    split_item *s = split_new(n, evlog_now());
+    for(int i=0; i<s->chunks; i++) {
+      if(npending == producer_batch) {
+        flush_work();
+      }
+      pending[npending].work = split_chunk(s, i);
+      pending[npending].count = 1;
+      pending[npending].split = s;
+      npending++;
+    }
+    if(coalesce_limit == 0 && npending == producer_batch) {
+      flush_work();
+    }
+    return;
+  }
+  // A chunk of a split item completes as part of that item, so never merge into one
+  if(npending > 0 && n <= coalesce_limit && pending[npending-1].work == n &&
+      pending[npending-1].count < MAX_RUN && pending[npending-1].split == NULL) {
+    pending[npending-1].count += 1;
+    return;
+  }
+  if(npending == producer_batch) {
+    flush_work();
+  }
+  pending[npending].work = n;
+  pending[npending].count = 1;
+  pending[npending].split = NULL;
+  npending++;
+  if(coalesce_limit == 0 && npending == producer_batch) {
+    flush_work();
+  }
+}
+
+
+/*
+* Flush work
+*
+* Publishes all pending work items to the work queue
+*/
+void flush_work() {
+  if(npending > 0) {
+    put_work(pending, npending);
+    npending = 0;
+  }
+}
+
+
+/*
+* Split new
+*
+* Starts splitting an item of n units into the fewest chunks of at most
+* split_limit units, counted against the calling producer. Its response time
+* runs from now until the last chunk completes.
+*/
+split_item * split_new(int n, int64_t now) {
+  split_item *s = malloc(sizeof(split_item));
+  if(s == NULL) {
+    perror("Split allocation failed");
+    exit(1);
+  }
+  s->chunks = (n + split_limit - 1) / split_limit;
+  s->work = n;
+  s->split_ns = now;
+  atomic_init(&s->remaining, s->chunks);
+  thread_stat *stats = &thread_stats[log_slot < 0 ? PRODUCER_ID : log_slot];
+  stats->splits += 1;
+  stats->chunks += s->chunks;
+  return s;
+}
+
+
+/*
+* Split chunk
+*
+* Returns the units of chunk i. Chunks differ in size by at most one unit.
+*/
+int split_chunk(split_item *s, int i) {
+  return s->work / s->chunks + (i < s->work % s->chunks);
+}
+
+
+/*
+* Complete
+*
+* Logs the completion of a work item and records its service and response
+* times, returning when it completed. A chunk of a split item only adds its
+* service time, except the last to finish, which completes the whole item.
+*/
+int64_t complete(work_item *item, int id, int64_t received) {
+  thread_stat *stats = &thread_stats[id];
+  split_item *s = item->split;
+  if(s != NULL && atomic_fetch_sub(&s->remaining, 1) > 1) {
+    int64_t completed = evlog_now();
+    hist_record(&stats->service, completed - received, 1);
+    return completed;
+  }
+  print_message(Complete, s != NULL ? s->work : item->work, id, 0);
+  int64_t completed = evlog_now();
+  hist_record(&stats->service, completed - received, 1);
+  hist_record(&stats->response, completed - (s != NULL ? s->split_ns : item->enq_ns), 1);
+  free(s);
+  return completed;
+}
+
+
+/*
+* Put work
+*
+* Adds n work items to the selected work queue, waiting while the queue is full.
+* The mutex queue is provided with mutual exclusion using the count_mutex, which
+* is taken once for the whole batch unless the queue fills part way through. The
+* lock-free queues place as many items as fit per attempt until every item is
+* placed. With parked waiting exactly one consumer is woken per item published.
+* A pipeline takes items one at a time into its first stage.
+*/
+void put_work(work_item *items, int n) {
+  int slot = log_slot < 0 ? PRODUCER_ID : log_slot;
+  if(pipeline_spec != NULL) {
+    // Producers after the first take the slots after the pool manager
+    int producer = (slot == PRODUCER_ID) ? 0 : slot - nthreads - 1;
+    lfring *first = &chain.stages[0].queue;
+    for(int i=0; i<n; i++) {
+      // Work is logged when the item is submitted, before the first stage can
+      // take it, with the depth it joins the queue at
+      int depth = lfring_count(first);
+      print_items(Work, &items[i], 1, PRODUCER_ID, depth < (int)first->size ? depth + 1 : depth);
+      items[i].enq_ns = evlog_now();
+      pipeline_submit(&chain, producer, items[i]);
+    }
+    return;
+  }
+  thread_stat *stats = &thread_stats[slot];
+  if(queue_type != Mutex_Queue) {
+    while(n > 0) {
+      // Time blocked is only counted once the queue has been found full
+      int pushed = push_work(PRODUCER_ID, items, n);
+      if(pushed == 0) {
+        int64_t blocked = evlog_now();
+        pushed = await(push_work, PRODUCER_ID, items, n, &shared->space_ready, false);
+        stats->blocked_ns += evlog_now() - blocked;
+      }
+      if(wait_type == Park_Wait) {
+        evcount_notify(&shared->work_ready, pushed);
+      }
+      items += pushed;
+      n -= pushed;
+    }
+    return;
+  }
+  if(lock_mutex(&count_mutex, Count_Lock, slot) != 0) {
+    perror("Mutex lock error");
+    exit(1);
+  }
+  int unsignaled = 0;
+  for(int i=0; i<=n; i++) {
+    if(i == n || queue_full()) {
+      // Notify consumers of the work added so far
+      if(wait_type == Yield_Wait && unsignaled > 0) {
+        if(pthread_cond_broadcast(&full) != 0) {
+          perror("Condition broadcast error");
+          exit(1);
+        }
+      }
+      for(; wait_type == Park_Wait && unsignaled > 0; unsignaled--) {
+        if(pthread_cond_signal(&full) != 0) {
+          perror("Condition signal error");
+          exit(1);
+        }
+      }
+      unsignaled = 0;
+    }
+    if(i == n) break;
+    if(queue_full()) {
+      int64_t blocked = evlog_now();
+      while(queue_full()) {
+        // Cannot add work until a consumer finishes some existing work
+        if(wait_cond(&empty, Empty_Wait, &count_mutex, Count_Lock, slot) != 0) {
+          perror("Condition wait error");
+          exit(1);
+        }
+      }
+      stats->blocked_ns += evlog_now() - blocked;
+    }
+    // Add work to FIFO, logging the depth it will leave the queue at
+    print_items(Work, &items[i], 1, PRODUCER_ID, queue_depth() + 1);
+    items[i].enq_ns = evlog_now();
+    queue_insert(items[i]);
+    unsignaled++;
+  }
+  if(unlock_mutex(&count_mutex, Count_Lock, slot) != 0) {
+    perror("Mutex unlock error");
+    exit(1);
+  }
+}
+
+
+/*
+* Get work
+*
+* Takes up to consumer_batch work items from the selected work queue, waiting
+* while the queue is empty. Returns the number of items taken, 0 once the EOF
+* has been detected and no work remains, or -1 when the idle consumer has been
+* asked to retire by the pool manager.
+*/
+int get_work(int id, work_item *items) {
+  int n;
+  if(queue_type != Mutex_Queue) {
+    if((n = await(take_work, id, items, consumer_batch, &shared->work_ready, true)) <= 0) {
+      return n;
+    }
+    print_items(Receive, items, n, id, queue_depth());
+    if(wait_type == Park_Wait) {
+      evcount_notify(&shared->space_ready, 1);
+    }
+    return n;
+  }
+  if(lock_mutex(&count_mutex, Count_Lock, id) != 0) {
+    perror("Mutex lock error");
+    exit(1);
+  }
+  while(queue_empty()) {
+    if(shared->end_of_input) {
+      if(unlock_mutex(&count_mutex, Count_Lock, id) != 0) {
+        perror("Mutex unlock error");
+        exit(1);
+      }
+      return 0;
+    }
+    if(retire_consumer()) {
+      if(unlock_mutex(&count_mutex, Count_Lock, id) != 0) {
+        perror("Mutex unlock error");
+        exit(1);
+      }
+      return -1;
+    }
+    if(wait_cond(&full, Full_Wait, &count_mutex, Count_Lock, id) != 0) {
+      perror("Condition wait error");
+      exit(1);
+    }
+  }
+  // Receive work, logging the depth each entry left the queue at
+  for(n = 0; n < consumer_batch && queue_remove(&items[n]); n++);
+  for(int i=0; i<n; i++) {
+    print_items(Receive, &items[i], 1, id, queue_depth() + n - 1 - i);
+  }
+  if(pthread_cond_signal(&empty) != 0) {
+    perror("Condition signal error");
+    exit(1);
+  }
+  if(unlock_mutex(&count_mutex, Count_Lock, id) != 0) {
+    perror("Mutex unlock error");
+    exit(1);
+  }
+  return n;
+}
+
+
+/*
+* Queue full
+*
+* Whether the mutex queue under the selected policy has no free entries. The
+* caller holds count_mutex, as for the remaining queue helpers.
+*/
+bool queue_full() {
+  return policy == Fifo_Policy ? fifo_full(&queue) : pqueue_full(&heap);
+}
+
+
+/*
+* Queue empty
+*
+* Whether the mutex queue under the selected policy holds no entries
+*/
+bool queue_empty() {
+  return policy == Fifo_Policy ? fifo_empty(&queue) : pqueue_empty(&heap);
+}
+
+
+/*
+* Queue insert
+*
+* Adds a work item to the mutex queue. Shortest job first orders entries by
+* their size in Trans units. Aging orders them by enqueue time plus
+* AGING_WEIGHT times their expected run time, so a large entry waits at most
+* that long behind work that arrives after it and is never starved.
+*/
+void queue_insert(work_item item) {
+  if(policy != Fifo_Policy) {
+    pqueue_insert(item, queue_key(&item), &heap);
   } else {
-    fprintf(fd, "    Work          %d\n", msg_stats[Work]);
-  }
-  if(msg_stats[Ask] > 999) {
-    fprintf(fd, "    Ask        %d\n", msg_stats[Ask]);
-  } else if (msg_stats[Ask] > 99) {
-    fprintf(fd, "    Ask         %d\n", msg_stats[Ask]);
-  } else if (msg_stats[Ask] > 9) {
-    fprintf(fd, "    Ask          %d\n", msg_stats[Ask]);
+    enqueue(item, &queue);
+  }
+  atomic_fetch_add_explicit(&queued, 1, memory_order_relaxed);
+  depth_change(queue_depth());
+}
+
+
+/*
+* Queue key
+*
+* Returns the heap key of a work item under the selected policy. FIFO gives
+* every entry the same key, so entries leave in insertion order.
+*/
+int64_t queue_key(const work_item *item) {
+  int64_t cost = (int64_t)item->work * item->count;
+  if(policy == Sjf_Policy) {
+    return cost;
+  } else if(policy == Aging_Policy) {
+    return item->enq_ns + AGING_WEIGHT * cost * trans_unit_ns;
+  }
+  return 0;
+}
+
+
+/*
+* Queue remove
+*
+* Takes the next work item from the mutex queue under the selected policy
+*/
+bool queue_remove(work_item *item) {
+  if(!(policy == Fifo_Policy ? dequeue(item, &queue) : pqueue_remove(item, &heap))) {
+    return false;
+  }
+  atomic_fetch_sub_explicit(&queued, 1, memory_order_relaxed);
+  depth_change(queue_depth());
+  return true;
+}
+
+
+/*
+* Take work
+*
+* Single non-blocking attempt to take up to n work items from a lock-free queue.
+* In steal mode the consumer's own deque is tried first, then its peers' in turn.
+*/
+int take_work(int id, work_item *items, int n) {
+  int res;
+  if(queue_type == Lockfree_Queue) {
+    return lfring_dequeue_batch(items, n, &shared->lfqueue);
+  }
+  if((res = wsdeque_steal(items, n, &deques[id-1])) > 0) {
+    return res;
+  }
+  for(int i=1; i<nthreads; i++) {
+    if((res = wsdeque_steal(items, n, &deques[(id-1 + i) % nthreads])) > 0) {
+      thread_stats[id].stolen += res;
+      return res;
+    }
+  }
+  return 0;
+}
+
+
+/*
+* Push work
+*
+* Single non-blocking attempt to place up to n work items on a lock-free queue.
+* In steal mode the producer owns every consumer's deque and pushes to one chosen
+* by the distribution policy, falling through to the following deques if the
+* chosen one is full. Work is logged once the items have room and before any
+* consumer can see them, as on the mutex queue, so a Receive never precedes it.
+*/
+int push_work(int id, work_item *items, int n) {
+  int64_t now = evlog_now();
+  for(int i=0; i<n; i++) {
+    items[i].enq_ns = now;
+  }
+  if(queue_type == Lockfree_Queue) {
+    size_t pos;
+    int claimed = lfring_claim(n, &pos, &shared->lfqueue);
+    if(claimed > 0) {
+      // The claimed slots already count toward the depth
+      int depth = queue_depth();
+      depth_seen(depth);
+      print_items(Work, items, claimed, PRODUCER_ID, depth);
+      lfring_publish(items, claimed, pos, &shared->lfqueue);
+    }
+    return claimed;
+  }
+  int target = next_deque;
+  if(distribution == Least_Loaded) {
+    for(int i=0; i<nthreads; i++) {
+      if(wsdeque_count(&deques[i]) < wsdeque_count(&deques[target])) {
+        target = i;
+      }
+    }
+  }
+  for(int i=0; i<nthreads; i++) {
+    wsdeque *d = &deques[(target + i) % nthreads];
+    int room = wsdeque_room(d);
+    if(room > 0) {
+      int pushed = (n < room) ? n : room;
+      int depth = queue_depth() + pushed;
+      depth_seen(depth);
+      print_items(Work, items, pushed, PRODUCER_ID, depth);
+      wsdeque_push(items, pushed, d);
+      next_deque = (target + i + 1) % nthreads;
+      return pushed;
+    }
+  }
+  return 0;
+}
+
+
+/*
+* Await
+*
+* Retries attempt() on a lock-free queue until it moves some items. With yield
+* waiting the thread backs off and yields between attempts. With parked waiting
+* it spins for up to spin_budget attempts, then sleeps on the eventcount e until
+* the other side publishes. The budget grows when spinning pays off and shrinks
+* when the thread ends up parking. When stop_at_end is set, returns 0 once the
+* EOF has been detected and a final attempt finds nothing, and -1 if the pool
+* manager retires the thread while it waits. A fiber parks on its worker
+* instead, which blocks for all of its fibers at once.
+*/
+int await(int (*attempt)(int, work_item *, int), int id, work_item *items, int n,
+    evcount *e, bool stop_at_end) {
+  int res;
+  if(fiber_current() != NULL) {
+    while((res = attempt(id, items, n)) == 0) {
+      if(stop_at_end && atomic_load(&shared->end_of_input)) {
+        return attempt(id, items, n);
+      }
+      fiber_park();
+    }
+    return res;
+  }
+  if(wait_type == Yield_Wait) {
+    int spins = 0;
+    while((res = attempt(id, items, n)) == 0) {
+      if(stop_at_end && atomic_load(&shared->end_of_input)) {
+        // The producer enqueues before raising the flag, so one more attempt
+        // is enough to tell a drained queue from a late item
+        return attempt(id, items, n);
+      }
+      if(stop_at_end && retire_consumer()) {
+        return -1;
+      }
+      if(!stop_at_end && consumer_processes && (res = check_consumers(items, n)) > 0) {
+        return res;
+      }
+      backoff(&spins);
+    }
+    return res;
+  }
+  for(int i=0; i<spin_budget; i++) {
+    if((res = attempt(id, items, n)) > 0) {
+      if(spin_budget < SPIN_MAX) spin_budget *= 2;
+      return res;
+    }
+    if(stop_at_end && atomic_load(&shared->end_of_input)) {
+      return attempt(id, items, n);
+    }
+    cpu_relax();
+  }
+  if(spin_budget > SPIN_MIN) spin_budget /= 2;
+  while(true) {
+    unsigned key = evcount_prepare(e);
+    if((res = attempt(id, items, n)) > 0) {
+      evcount_cancel(e);
+      return res;
+    }
+    if(stop_at_end && atomic_load(&shared->end_of_input)) {
+      evcount_cancel(e);
+      return attempt(id, items, n);
+    }
+    if(stop_at_end && retire_consumer()) {
+      evcount_cancel(e);
+      return -1;
+    }
+    if(!stop_at_end && consumer_processes && (res = check_consumers(items, n)) > 0) {
+      evcount_cancel(e);
+      return res;
+    }
+    evcount_wait(e, key);
+  }
+}
+
+
+/*
+* Context switches
+*
+* Returns the voluntary and involuntary context switches of the calling thread
+*/
+long context_switches() {
+  struct rusage usage;
+  if(getrusage(RUSAGE_THREAD, &usage) != 0) {
+    perror("Get resource usage failed");
+    exit(1);
+  }
+  return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+
+/*
+* Print items
+*
+* Print one status message per work item, expanding coalesced entries
+*/
+void print_items(int msg, work_item *items, int n, int id, int depth) {
+  for(int i=0; i<n; i++) {
+    for(int j=0; j<items[i].count; j++) {
+      print_message(msg, items[i].work, id, depth);
+    }
+  }
+}
+
+
+/*
+* Backoff
+*
+* Busy-waits for the first few retries on a lock-free queue, then yields the CPU
+* so a spinning thread does not starve the thread it is waiting on.
+*/
+void backoff(int *spins) {
+  if(*spins < SPIN_LIMIT) {
+    (*spins)++;
+    cpu_relax();
   } else {
-    fprintf(fd, "    Ask           %d\n", msg_stats[Ask]);
-  }
-  if(msg_stats[Receive] > 999) {
-    fprintf(fd, "    Receive    %d\n", msg_stats[Receive]);
-  } else if (msg_stats[Receive] > 99) {
-    fprintf(fd, "    Receive     %d\n", msg_stats[Receive]);
-  } else if (msg_stats[Receive] > 9) {
-    fprintf(fd, "    Receive      %d\n", msg_stats[Receive]);
+    sched_yield();
+  }
+}
+
+
+/*
+* Log writer thread task
+*
+* Repeatedly merges the per-thread event buffers in timestamp order and writes
+* them out, sleeping briefly when nothing new has been published. Once all other
+* threads are done the remaining records are written.
+*/
+void * log_writer(void *arg) {
+  struct timespec idle = {0, 1000000};
+  while(!atomic_load(&log_done)) {
+    int64_t horizon = evlog_horizon(log_buffers, nslots);
+    if(evlog_collect(log_buffers, nslots, horizon, write_record) == 0) {
+      nanosleep(&idle, NULL);
+    }
+  }
+  evlog_collect(log_buffers, nslots, INT64_MAX, write_record);
+  return NULL;
+}
+
+
+/*
+* Write record
+*
+* Write a status message to file output. Only the log writer thread calls this, so
+* no locking is needed.
+*/
+void write_record(evlog_record *r) {
+  evlog_format(fd, (r->ns - start_ns) / 1000000000.0, r->msg, r->val, r->id, r->depth);
+}
+
+
+/*
+* Print message
+*
+* Print a status message to file output along with calling thread id and work value.
+* This function is provided mutual exclusion since the file descriptor is written to
+* by multiple threads. With a buffered log the message is instead appended to the
+* calling thread's own event buffer and written out by the log writer. With a
+* binary log it is stored as a fixed-width record in the mapped log file. The
+* pool manager and the producers log as ID 0 but write through their own slots.
+* depth is the work queue depth left by a Work or Receive, and 0 otherwise.
+*/
+void print_message(int msg, int n, int id, int depth) {
+  int slot = log_slot < 0 ? id : log_slot;
+  // Check if msg is valid
+  if(msg < Ask || msg >= MESSAGE_TYPES) {
+    printf("Error: Invalid message type");
+    return;
+  }
+  // Update the calling thread's own message counts
+  thread_stats[slot].msgs[msg] += 1;
+  if(trace_path != NULL && (msg == Work || msg == Receive)) {
+    trace_counter(&tracer, "Queue depth", evlog_now(), depth);
+  }
+  if(log_type == Buffered_Log) {
+    evlog_append(msg, n, id, depth, &log_buffers[slot]);
+    return;
+  }
+  if(log_type == Binary_Log) {
+    binlog_append(&blog, slot, evlog_now() - start_ns, msg, n, id, depth);
+    return;
+  }
+  int err = lock_mutex(&shared->print_mutex, Print_Lock, slot);
+  if(err == EOWNERDEAD) {
+    // A consumer process died holding the lock, only its own line is lost
+    pthread_mutex_consistent(&shared->print_mutex);
+  } else if(err != 0) {
+    perror("Mutex lock error");
+    exit(1);
+  }
+  // Get total elapsed time and write to file
+  double current_time = (evlog_now() - start_ns) / 1000000000.0;
+  evlog_format(fd, current_time, msg, n, id, depth);
+  if(consumer_processes) {
+    // Each process has its own stdio buffer over the shared file offset
+    fflush(fd);
+  }
+  if(unlock_mutex(&shared->print_mutex, Print_Lock, slot) != 0){
+    perror("Mutex unlock error");
+    exit(1);
+  }
+}
+
+
+/*
+* Lock mutex
+*
+* Locks one of the profiled mutexes for the thread in the given slot. With lock
+* profiling the acquisition is counted against that slot, otherwise this is a
+* plain pthread_mutex_lock.
+*/
+int lock_mutex(pthread_mutex_t *m, int lock, int slot) {
+  if(!lock_profile) {
+    return pthread_mutex_lock(m);
+  }
+  return lockstat_lock(m, &thread_stats[slot].locks[lock]);
+}
+
+
+/*
+* Unlock mutex
+*
+* Unlocks a mutex taken with lock_mutex, ending its hold time
+*/
+int unlock_mutex(pthread_mutex_t *m, int lock, int slot) {
+  if(!lock_profile) {
+    return pthread_mutex_unlock(m);
+  }
+  return lockstat_unlock(m, &thread_stats[slot].locks[lock]);
+}
+
+
+/*
+* Wait cond
+*
+* Waits on a condition with its mutex taken by lock_mutex, counting the wait
+* against the condition and pausing the mutex's hold time
+*/
+int wait_cond(pthread_cond_t *c, int cond, pthread_mutex_t *m, int lock, int slot) {
+  if(!lock_profile) {
+    return pthread_cond_wait(c, m);
+  }
+  return lockstat_wait(c, m, &thread_stats[slot].locks[cond], &thread_stats[slot].locks[lock]);
+}
+
+
+/*
+* Start consumer
+*
+* Runs a consumer thread in the given slot, joining the thread that last used it.
+* With consumer processes the consumer is forked instead and exits with its
+* last thread.
+*/
+void start_consumer(int slot) {
+  if(atomic_load(&slot_states[slot]) == Slot_Exited) {
+    if(pthread_join(consumers[slot], NULL) != 0) {
+      printf("Pthread join failed\n");
+      exit(1);
+    }
+  }
+  atomic_store(&slot_states[slot], Slot_Running);
+  int size = atomic_fetch_add(&pool_size, 1) + 1;
+  if(size > pool_peak) pool_peak = size;
+  if(consumer_processes) {
+    // Flush first so the child does not write the buffered output again
+    fflush(fd);
+    fflush(stdout);
+    if((consumer_pids[slot] = fork()) < 0) {
+      perror("Fork failed");
+      exit(1);
+    }
+    if(consumer_pids[slot] == 0) {
+      consume((void *)&ids[slot]);
+    }
+    return;
+  }
+  if(pthread_create(&consumers[slot], NULL, &consume, (void *)&ids[slot]) != 0) {
+    perror("Pthread create failed");
+    exit(1);
+  }
+}
+
+
+/*
+* Retire consumer
+*
+* Claims one pending retire request for the calling idle consumer
+*/
+bool retire_consumer() {
+  int requests = atomic_load(&retire_requests);
+  while(requests > 0) {
+    if(atomic_compare_exchange_weak(&retire_requests, &requests, requests - 1)) {
+      atomic_fetch_sub(&pool_size, 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/*
+* Queue depth
+*
+* Returns the number of entries currently held by the work queue, or by every
+* stage queue of a pipeline. The mutex queue's count is read with a relaxed
+* load instead of taking count_mutex, so sampling never holds up the producer
+* or consumers; the value may be a moment stale.
+*/
+int queue_depth() {
+  int depth = 0;
+  if(pipeline_spec != NULL) {
+    for(int i=0; i<chain.nstages; i++) {
+      depth += lfring_count(&chain.stages[i].queue);
+    }
+  } else if(queue_type == Lockfree_Queue) {
+    depth = lfring_count(&shared->lfqueue);
+  } else if(queue_type == Steal_Queue) {
+    for(int i=0; i<nthreads; i++) {
+      depth += wsdeque_count(&deques[i]);
+    }
   } else {
-    fprintf(fd, "    Receive       %d\n", msg_stats[Receive]);
-  }
-  if(msg_stats[Complete] > 999) {
-    fprintf(fd, "    Complete   %d\n", msg_stats[Complete]);
-  } else if (msg_stats[Complete] > 99) {
-    fprintf(fd, "    Complete    %d\n", msg_stats[Complete]);
-  } else if (msg_stats[Complete] > 9) {
-    fprintf(fd, "    Complete     %d\n", msg_stats[Complete]);
+    depth = atomic_load_explicit(&queued, memory_order_relaxed);
+  }
+  return depth;
+}
+
+
+/*
+* Depth change
+*
+* Accounts the time the mutex queue spent at its previous depth, and at zero,
+* before moving to the new depth. The caller holds count_mutex.
+*/
+void depth_change(int depth) {
+  int64_t now = evlog_now();
+  int64_t elapsed = now - depth_stats.last_ns;
+  depth_stats.area += depth_stats.depth * elapsed;
+  if(depth_stats.depth == 0) {
+    depth_stats.empty_ns += elapsed;
+  }
+  depth_stats.depth = depth;
+  depth_stats.last_ns = now;
+  depth_seen(depth);
+}
+
+
+/*
+* Depth seen
+*
+* Raises the maximum queue depth to depth
+*/
+void depth_seen(int depth) {
+  int max = atomic_load_explicit(&shared->max_depth, memory_order_relaxed);
+  while(depth > max && !atomic_compare_exchange_weak(&shared->max_depth, &max, depth));
+}
+
+
+/*
+* Pool manager thread task
+*
+* Samples the work queue every POOL_SAMPLE_NS. A consumer is added when the
+* queue stays at least three quarters full, or the latest queue wait seen by a
+* consumer stays above POOL_GROW_WAIT_NS, for POOL_GROW_SAMPLES samples in a
+* row. When the queue has been empty for POOL_COOLDOWN_NS one idle consumer is
+* asked to retire, and the waiting consumers are woken so one can take the
+* request. Each resize is logged with the new pool size.
+*/
+void * pool_manager(void *arg) {
+  struct timespec interval = {0, POOL_SAMPLE_NS};
+  int size = queue_size;
+  int pressured = 0;
+  int64_t idle_since = evlog_now();
+  log_slot = nthreads + 1;
+  while(!atomic_load(&pool_done)) {
+    nanosleep(&interval, NULL);
+    int depth = queue_depth();
+    int64_t now = evlog_now();
+    int64_t wait = 0;
+    for(int i=1; i<=nthreads; i++) {
+      int64_t w = atomic_exchange_explicit(&thread_stats[i].recent_wait, 0,
+          memory_order_relaxed);
+      if(w > wait) wait = w;
+    }
+    // Retire requests not yet taken still count against the pool
+    int target = atomic_load(&pool_size) - atomic_load(&retire_requests);
+    if(depth > 0 && (depth * 4 >= size * 3 || wait > POOL_GROW_WAIT_NS)) {
+      pressured++;
+    } else {
+      pressured = 0;
+    }
+    if(depth > 0) {
+      idle_since = now;
+    }
+    if(pressured >= POOL_GROW_SAMPLES && target < pool_max) {
+      // Withdraw a retire request still waiting to be taken before starting a
+      // new thread. A consumer that just retired may not have freed its slot
+      // yet, in which case the next sample tries again.
+      int requests = atomic_load(&retire_requests);
+      bool grown = requests > 0 &&
+          atomic_compare_exchange_strong(&retire_requests, &requests, requests - 1);
+      for(int i=0; i<nthreads && !grown; i++) {
+        if(atomic_load(&slot_states[i]) != Slot_Running) {
+          start_consumer(i);
+          grown = true;
+        }
+      }
+      if(grown) {
+        print_message(Resize, target + 1, 0, 0);
+        pressured = 0;
+        idle_since = now;
+      }
+    } else if(now - idle_since >= POOL_COOLDOWN_NS && target > pool_min) {
+      atomic_fetch_add(&retire_requests, 1);
+      if(queue_type == Lockfree_Queue) {
+        evcount_notify_all(&shared->work_ready);
+      } else {
+        if(lock_mutex(&count_mutex, Count_Lock, log_slot) != 0) {
+          perror("Mutex lock error");
+          exit(1);
+        }
+        if(pthread_cond_broadcast(&full) != 0) {
+          perror("Condition broadcast error");
+          exit(1);
+        }
+        if(unlock_mutex(&count_mutex, Count_Lock, log_slot) != 0) {
+          perror("Mutex unlock error");
+          exit(1);
+        }
+      }
+      print_message(Resize, target - 1, 0, 0);
+      idle_since = now;
+    }
+  }
+  return NULL;
+}
+
+
+/*
+* Fiber worker thread task
+*
+* Runs the worker's consumer fibers until they have all exited
+*/
+void * fiber_thread(void *arg) {
+  int i = (int)(intptr_t)arg;
+  perf_start(worker_perf[i]);
+  pin_thread(nproducers + i);
+  fiber_worker_run(&workers[i]);
+  worker_csw[i] = context_switches();
+  return NULL;
+}
+
+
+/*
+* Fiber idle
+*
+* Called by a worker with every fiber parked. Waits until the queue holds work
+* or the EOF has been detected, parking the thread on work_ready or yielding
+* as set by the wait type. Returns how many fibers to resume: one per queued
+* entry, or all of them at the EOF so each can see it and exit.
+*/
+int fiber_idle(fiber_worker *w) {
+  while(true) {
+    unsigned key = evcount_prepare(&shared->work_ready);
+    int depth = lfring_count(&shared->lfqueue);
+    if(depth > 0 || atomic_load(&shared->end_of_input)) {
+      evcount_cancel(&shared->work_ready);
+      return atomic_load(&shared->end_of_input) ? w->nparked : depth;
+    }
+    if(wait_type == Park_Wait) {
+      evcount_wait(&shared->work_ready, key);
+    } else {
+      evcount_cancel(&shared->work_ready);
+      sched_yield();
+    }
+  }
+}
+
+
+/*
+* Parse pipeline
+*
+* Sets up a pipeline stage for each comma separated kernel:threads[:queue] in
+* spec. The kernel is "sum" or one of the transaction kernels, threads
+* defaults to the nthreads argument and queue to the -s size or twice the
+* stage's threads. Returns the total number of stage workers.
+*/
+int parse_pipeline(char *spec) {
+  char *stages[MAX_STAGES];
+  int nstages = 0;
+  for(char *st = strtok(spec, ","); st != NULL; st = strtok(NULL, ",")) {
+    if(nstages == MAX_STAGES) {
+      printf("Error: Too many pipeline stages provided\n");
+      exit(1);
+    }
+    stages[nstages++] = st;
+  }
+  if(nstages == 0) {
+    printf("Error: Invalid pipeline provided\n");
+    exit(1);
+  }
+  pipeline_init(&chain, nstages, nproducers);
+  int total = 0;
+  for(int i=0; i<nstages; i++) {
+    char *name = strtok(stages[i], ":");
+    char *threads = strtok(NULL, ":");
+    char *size = strtok(NULL, ":");
+    int nworkers = (threads != NULL) ? atoi(threads) : nthreads;
+    int capacity = (size != NULL) ? atoi(size) : queue_size ? queue_size : nworkers * 2;
+    stage_fn fn = stage_kernel;
+    if(strcmp(name, "sum") == 0) {
+      fn = stage_sum;
+    } else if((stage_kernels[i] = kernel_find(name)) == NULL) {
+      printf("Error: Invalid pipeline stage provided\n");
+      exit(1);
+    }
+    if(nworkers < 1 || capacity < 1) {
+      printf("Error: Invalid pipeline stage provided\n");
+      exit(1);
+    }
+    pipeline_stage(&chain, i, name, fn, nworkers, capacity, total + 1);
+    total += nworkers;
+  }
+  return total;
+}
+
+
+/*
+* Stage kernel
+*
+* Pipeline stage running the stage's transaction kernel on every unit of an item
+*/
+void stage_kernel(work_item *item, int stage, int id) {
+  stage_item(item, stage, id, false);
+}
+
+
+/*
+* Stage sum
+*
+* Pipeline stage adding every unit of an item to the worker's aggregate
+*/
+void stage_sum(work_item *item, int stage, int id) {
+  stage_item(item, stage, id, true);
+}
+
+
+/*
+* Stage item
+*
+* Logs and times one item through a pipeline stage. Receive is logged at every
+* stage and Complete at the last. Queue wait is taken at the first stage and
+* response time at the last, both from when the producer submitted the item.
+*/
+void stage_item(work_item *item, int stage, int id, bool aggregate) {
+  thread_stat *stats = &thread_stats[id];
+  perf_start(stats->perf);
+  pin_thread(nproducers + id - 1);
+  print_items(Receive, item, 1, id, lfring_count(&chain.stages[stage].queue));
+  int64_t received = evlog_now();
+  int64_t begin = received;
+  atomic_store(&stats->busy_since, received);
+  if(stage == 0) {
+    hist_record(&stats->wait, received - item->enq_ns, item->count);
+  }
+  for(int j=0; j<item->count; j++) {
+    if(aggregate) {
+      stats->aggregate += item->work;
+    } else {
+      kernel_run(stage_kernels[stage], item->work);
+    }
+    // An item completes once, at the last stage, so counts and throughput are
+    // per item rather than per stage
+    if(stage == chain.nstages - 1) {
+      print_message(Complete, item->work, id, 0);
+    }
+    int64_t completed = evlog_now();
+    busy_until(id, completed, true);
+    hist_record(&stats->service, completed - received, 1);
+    if(stage == chain.nstages - 1) {
+      hist_record(&stats->response, completed - item->enq_ns, 1);
+    }
+    if(trace_path != NULL) {
+      trace_slice(&tracer, id, chain.stages[stage].name, begin, completed, item->work);
+    }
+    begin = completed;
+  }
+  busy_until(id, evlog_now(), false);
+}
+
+
+/*
+* Busy until
+*
+* Credits consumer id with the busy time since its mark up to t, then moves the
+* mark on to t, or clears it when the consumer goes idle. Crediting each unit
+* as it completes, and letting a report count the open stretch since the mark,
+* keeps a long batch from landing in a single window. Only the consumer writes
+* its counters, and it stores the total before the mark.
+*/
+void busy_until(int id, int64_t t, bool busy) {
+  thread_stat *stats = &thread_stats[id];
+  int64_t since = atomic_load_explicit(&stats->busy_since, memory_order_relaxed);
+  atomic_store(&stats->busy_ns, atomic_load_explicit(&stats->busy_ns,
+      memory_order_relaxed) + t - since);
+  atomic_store(&stats->busy_since, busy ? t : 0);
+}
+
+
+/*
+* Reporter thread task
+*
+* Writes a line of live statistics every report_ms, and at once whenever the
+* process receives SIGUSR1. An interval of 0 reports on the signal only.
+*/
+void * reporter(void *arg) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  struct timespec interval = {report_ms / 1000, (report_ms % 1000) * 1000000L};
+  int64_t last_ns = start_ns;
+  int64_t busy[nthreads];
+  memset(busy, 0, sizeof(busy));
+  hist prev;
+  hist_init(&prev);
+  while(true) {
+    // Returns on the signal, or with EAGAIN once the interval is up
+    sigtimedwait(&set, NULL, report_ms > 0 ? &interval : NULL);
+    if(atomic_load(&report_done)) break;
+    report(report_fd, &last_ns, busy, &prev);
+  }
+  return NULL;
+}
+
+
+/*
+* Report
+*
+* Writes the throughput, queue depth, p99 response time and per-consumer
+* utilization over the window since the previous report, then starts a new
+* window. Counters are read with relaxed loads while their threads keep
+* updating them, so no lock on the work path is taken. A consumer's busy time
+* includes the stretch since its last credit, and since the two counters are
+* not read together a window's utilization is clamped to 0-100%. Beyond
+* REPORT_UTIL_ROWS consumers the utilization is summarized as avg/min/max.
+*/
+void report(FILE *out, int64_t *last_ns, int64_t *busy, hist *prev) {
+  int64_t now_ns = evlog_now();
+  double window = (now_ns - *last_ns) / 1000000000.0;
+  hist now, delta;
+  hist_init(&now);
+  for(int i=1; i<=nthreads; i++) {
+    hist_merge(&now, &thread_stats[i].response);
+  }
+  hist_delta(&delta, &now, prev);
+  fprintf(out, "[%8.3f] %10.1f tps, depth %4d, p99 %8.3f ms, util",
+      (now_ns - start_ns) / 1000000000.0, window > 0 ? delta.total / window : 0,
+      queue_depth(), hist_percentile(&delta, 99.0) / 1000000.0);
+  double sum = 0, lo = 100, hi = 0;
+  for(int i=0; i<nthreads; i++) {
+    int64_t b = atomic_load(&thread_stats[i+1].busy_ns);
+    int64_t since = atomic_load(&thread_stats[i+1].busy_since);
+    if(since > 0 && since < now_ns) {
+      b += now_ns - since;
+    }
+    double util = window > 0 ? 100.0 * (b - busy[i]) / (now_ns - *last_ns) : 0;
+    if(util > 100) util = 100;
+    if(util < 0) util = 0;
+    busy[i] = b;
+    sum += util;
+    if(util < lo) lo = util;
+    if(util > hi) hi = util;
+    if(nthreads <= REPORT_UTIL_ROWS) {
+      fprintf(out, " %3.0f%%", util);
+    }
+  }
+  if(nthreads > REPORT_UTIL_ROWS) {
+    fprintf(out, " avg %.0f%% min %.0f%% max %.0f%%", sum / nthreads, lo, hi);
+  }
+  fprintf(out, "\n");
+  fflush(out);
+  hist_init(prev);
+  hist_merge(prev, &now);
+  *last_ns = now_ns;
+}
+
+
+/*
+* Perf start
+*
+* Opens performance counters for the calling thread when enabled, unless it
+* already has them. They are added to out when the thread exits, so a reused
+* consumer slot accumulates the counts of every thread that ran in it.
+*/
+void perf_start(uint64_t *out) {
+  if(!perf_counters || pthread_getspecific(perf_key) != NULL) {
+    return;
+  }
+  perf_thread *t = malloc(sizeof(perf_thread));
+  if(t == NULL || !perfctr_open(&t->ctr)) {
+    printf("Error: Could not open performance counters\n");
+    exit(1);
+  }
+  t->out = out;
+  pthread_setspecific(perf_key, t);
+}
+
+
+/*
+* Perf stop
+*
+* Destructor of perf_key, run as a thread exits
+*/
+void perf_stop(void *arg) {
+  perf_thread *t = (perf_thread *)arg;
+  uint64_t values[PERFCTR_MAX];
+  perfctr_read(&t->ctr, values);
+  for(int i=0; i<t->ctr.n; i++) {
+    t->out[i] += values[i];
+  }
+  perfctr_close(&t->ctr);
+  free(t);
+}
+
+
+/*
+* Pin thread
+*
+* Binds the calling thread to its CPU under the -a placement, once. Producers
+* take placement indices from 0, then consumer threads (or fiber workers) in
+* id order.
+*/
+void pin_thread(int index) {
+  if(npin == 0 || pinned) {
+    return;
+  }
+  if(!topology_pin(placement_cpu(index))) {
+    printf("Error: Could not pin thread to CPU %d\n", placement_cpu(index));
+    exit(1);
+  }
+  pinned = true;
+}
+
+
+/*
+* Placement CPU
+*
+* Returns the CPU for a placement index, wrapping around the placement order
+*/
+int placement_cpu(int index) {
+  return pin_cpus[index % npin];
+}
+
+
+/*
+* Simulate run
+*
+* Replays the trace through the discrete-event model instead of running it.
+* Each unit of work costs the calibrated kernel unit and a Sleep its nominal
+* time, and every modelled event is counted in the statistics the summary
+* reads, as the producer and consumers would count it.
+*/
+void simulate_run(FILE *in) {
+  int64_t begin = evlog_now();
+  sim model;
+  sim_init(&model, nthreads, queue_size, trans_unit_ns, queue_key, simulate_record);
+  char line[LINE_LENGTH];
+  char c;
+  int n;
+  while(fgets(line, LINE_LENGTH, in) != NULL) {
+    c = line[0];
+    check_input(line, &c, &n);
+    if(c == 'S') {
+      // Sleep takes out of range values as 1
+      thread_stats[PRODUCER_ID].msgs[Tands_Sleep] += 1;
+      sim_sleep(&model, (int64_t)(n <= 0 || n >= 100 ? 1 : n) * SLEEP_UNIT_NS);
+    } else {
+      work_item item = {n, 1, 0, NULL};
+      if(split_limit > 0 && n > split_limit) {
+        item.split = split_new(n, model.now);
+      }
+      for(int i=0; i<(item.split != NULL ? item.split->chunks : 1); i++) {
+        if(item.split != NULL) {
+          item.work = split_chunk(item.split, i);
+        }
+        sim_work(&model, item);
+      }
+    }
+  }
+  simulated_ns = sim_finish(&model);
+  depth_stats.area = model.area;
+  depth_stats.empty_ns = model.empty_ns;
+  atomic_store(&shared->max_depth, model.max_depth);
+  thread_stats[PRODUCER_ID].blocked_ns = model.blocked_ns;
+  sim_deinit(&model);
+  simulate_wall_ns = evlog_now() - begin;
+}
+
+
+/*
+* Simulate record
+*
+* Counts one modelled event at virtual time t against the thread that would
+* have logged it
+*/
+void simulate_record(int msg, const work_item *item, int id, int64_t t) {
+  thread_stat *stats = &thread_stats[id];
+  int64_t service = item != NULL ? (int64_t)item->work * item->count * trans_unit_ns : 0;
+  if(msg == Complete && item->split != NULL &&
+      atomic_fetch_sub(&item->split->remaining, 1) > 1) {
+    hist_record(&stats->service, service, 1);
+    return;
+  }
+  stats->msgs[msg] += 1;
+  if(msg == Receive) {
+    hist_record(&stats->wait, t - item->enq_ns, item->count);
+    stats->queued_ns += t - item->enq_ns;
+  } else if(msg == Complete && item->split != NULL) {
+    hist_record(&stats->service, service, 1);
+    hist_record(&stats->response, t - item->split->split_ns, 1);
+    free(item->split);
+  } else if(msg == Complete) {
+    hist_record(&stats->service, service, 1);
+    hist_record(&stats->response, t - item->enq_ns, 1);
+  }
+}
+
+
+/*
+* Run time
+*
+* Returns the nanoseconds elapsed since start, or the modelled length of a
+* simulated run
+*/
+int64_t run_ns() {
+  return simulate ? simulated_ns : evlog_now() - start_ns;
+}
+
+
+/*
+* Print summary
+*
+* Total the per-thread statistics and print them to file output
+*/
+void print_summary() {
+  // Get total elapsed time
+  double current_time = run_ns() / 1000000000.0;
+  // Sum message counts over all threads, and completions per consumer
+  int msg_stats[MESSAGE_TYPES] = {0};
+  int completed[nthreads];
+  for(int i=0; i<nslots; i++) {
+    for(int msg=Ask; msg<MESSAGE_TYPES; msg++) {
+      msg_stats[msg] += thread_stats[i].msgs[msg];
+    }
+    if(i > 0 && i <= nthreads) {
+      completed[i-1] = thread_stats[i].msgs[Complete];
+    }
+  }
+  // Write to file
+  evlog_summary(fd, msg_stats, completed, nthreads, current_time);
+  if(queue_type == Steal_Queue) {
+    fprintf(fd, "Stolen:\n");
+    for(int i=0; i<nthreads; i++) {
+      evlog_thread_row(fd, i, thread_stats[i+1].stolen);
+    }
+  }
+  if(pool_max > 0) {
+    fprintf(fd, "Pool:\n");
+    fprintf(fd, "    Min           %d\n", pool_min);
+    fprintf(fd, "    Max           %d\n", pool_max);
+    fprintf(fd, "    Peak          %d\n", pool_peak);
+    fprintf(fd, "    Resizes       %d\n", msg_stats[Resize]);
+  }
+  if(strcmp(work_kernel->name, "trans") != 0) {
+    fprintf(fd, "Kernel: %s, %d steps per unit, unit %.3f ms\n", work_kernel->name,
+        work_kernel->reps, work_kernel->unit_ns / 1000000.0);
+  }
+  if(pipeline_spec == NULL) {
+    print_depth();
+  }
+  if(policy != Fifo_Policy) {
+    fprintf(fd, "Queue policy: %s, Trans unit %.3f ms\n",
+        policy == Sjf_Policy ? "sjf" : "aging", trans_unit_ns / 1000000.0);
+  }
+  if(split_limit > 0) {
+    int splits = 0, chunks = 0;
+    for(int i=0; i<nproducers; i++) {
+      splits += thread_stats[producer_slot(i)].splits;
+      chunks += thread_stats[producer_slot(i)].chunks;
+    }
+    fprintf(fd, "Split: %d items above %d units into %d chunks\n", splits, split_limit,
+        chunks);
+  }
+  if(nproducers > 1) {
+    fprintf(fd, "Produced:\n");
+    for(int i=0; i<nproducers; i++) {
+      fprintf(fd, "    Producer %-4d %d\n", i, thread_stats[producer_slot(i)].msgs[Work]);
+    }
+  }
+  if(pipeline_spec != NULL) {
+    long total = 0;
+    for(int i=1; i<=nthreads; i++) {
+      total += thread_stats[i].aggregate;
+    }
+    pipeline_summary(fd, &chain);
+    fprintf(fd, "Aggregate total: %ld\n", total);
+  }
+  if(simulate) {
+    fprintf(fd, "Simulated: %d consumers, unit %.3f ms, modelled in %.3f ms\n", nthreads,
+        trans_unit_ns / 1000000.0, simulate_wall_ns / 1000000.0);
   } else {
-    fprintf(fd, "    Complete      %d\n", msg_stats[Complete]);
-  }
-  if(msg_stats[Tands_Sleep] > 999) {
-    fprintf(fd, "    Sleep      %d\n", msg_stats[Tands_Sleep]);
-  } else if (msg_stats[Tands_Sleep] > 99) {
-    fprintf(fd, "    Sleep       %d\n", msg_stats[Tands_Sleep]);
-  } else if (msg_stats[Tands_Sleep] > 9) {
-    fprintf(fd, "    Sleep        %d\n", msg_stats[Tands_Sleep]);
+    long total_csw = 0;
+    fprintf(fd, "Context switches:\n");
+    for(int i=0; i<nproducers; i++) {
+      total_csw += thread_stats[producer_slot(i)].csw;
+      if(nproducers == 1) {
+        fprintf(fd, "    Producer      %ld\n", thread_stats[PRODUCER_ID].csw);
+      } else {
+        fprintf(fd, "    Producer %-4d %ld\n", i, thread_stats[producer_slot(i)].csw);
+      }
+    }
+    for(int i=0; i<nthreads && nworkers == 0; i++) {
+      total_csw += thread_stats[i+1].csw;
+      evlog_thread_row(fd, i, thread_stats[i+1].csw);
+    }
+    for(int i=0; i<nworkers; i++) {
+      total_csw += worker_csw[i];
+      fprintf(fd, "    Worker  %-6d%ld\n", i+1, worker_csw[i]);
+    }
+    fprintf(fd, "    Total         %ld\n", total_csw);
+  }
+  if(nworkers > 0) {
+    fprintf(fd, "%-18s %8s %8s\n", "Fiber workers:", "fibers", "switches");
+    for(int i=0; i<nworkers; i++) {
+      fprintf(fd, "    Worker  %-6d %8d %8ld\n", i+1, (nthreads - i + nworkers - 1) / nworkers,
+          workers[i].switches);
+    }
+  }
+  if(npin > 0) {
+    print_placement();
+  }
+  if(consumer_processes) {
+    print_processes();
+  }
+  if(perf_counters) {
+    print_counters();
+  }
+  if(lock_profile) {
+    print_locks();
+  }
+  print_latency("Queue wait (ms):", Queue_Wait);
+  print_latency("Service time (ms):", Service_Time);
+  print_latency("Response time (ms):", Response_Time);
+  if(replay_scale > 0) {
+    fprintf(fd, "Replay speed: %.2fx\n", replay_scale);
+    print_latency("Schedule lag (ms):", Schedule_Lag);
+  }
+}
+
+
+/*
+* Print latency
+*
+* Print mean/p50/p90/p99/max of the queue wait, service time or response time
+* histograms for each consumer and for all consumers together, or of the
+* schedule lag for each producer and all producers together
+*/
+void print_latency(const char *title, int type) {
+  static const double percentiles[3] = {50.0, 90.0, 99.0};
+  hist all;
+  hist_init(&all);
+  fprintf(fd, "%-18s %8s %8s %8s %8s %8s\n", title, "mean", "p50", "p90", "p99", "max");
+  int rows = (type == Schedule_Lag) ? nproducers : nthreads;
+  for(int i=0; i<=rows; i++) {
+    hist *h = &all;
+    if(i < rows && type == Schedule_Lag) {
+      h = &thread_stats[producer_slot(i)].lag;
+      hist_merge(&all, h);
+      fprintf(fd, "    Producer %-5d", i);
+    } else if(i < rows) {
+      h = type == Service_Time ? &thread_stats[i+1].service :
+          type == Response_Time ? &thread_stats[i+1].response : &thread_stats[i+1].wait;
+      hist_merge(&all, h);
+      fprintf(fd, "    Thread  %-6d", i+1);
+    } else {
+      fprintf(fd, "    All           ");
+    }
+    fprintf(fd, " %8.3f", hist_mean(h) / 1000000.0);
+    for(int p=0; p<3; p++) {
+      fprintf(fd, " %8.3f", hist_percentile(h, percentiles[p]) / 1000000.0);
+    }
+    fprintf(fd, " %8.3f\n", h->max / 1000000.0);
+  }
+}
+
+
+/*
+* Print depth
+*
+* Print the maximum and time-weighted average depth of the work queue, the
+* time it spent empty and the time producers spent blocked on it being full.
+* The mutex queue's average and empty time are accounted at every change in
+* depth. The lock-free queues are never locked, so their average follows from
+* Little's law as the total time entries spent queued over the elapsed time,
+* and their empty time is not known.
+*/
+void print_depth() {
+  int64_t elapsed = run_ns();
+  int64_t blocked = 0;
+  for(int i=0; i<nproducers; i++) {
+    blocked += thread_stats[producer_slot(i)].blocked_ns;
+  }
+  double average;
+  if(queue_type == Mutex_Queue) {
+    if(!simulate) {
+      depth_change(depth_stats.depth);
+    }
+    average = (double)depth_stats.area / elapsed;
   } else {
-    fprintf(fd, "    Sleep         %d\n", msg_stats[Tands_Sleep]);
+    int64_t queued = 0;
+    for(int i=1; i<=nthreads; i++) {
+      queued += thread_stats[i].queued_ns;
+    }
+    average = (double)queued / elapsed;
+  }
+  fprintf(fd, "Queue depth:\n");
+  fprintf(fd, "    Size          %d\n", queue_size);
+  fprintf(fd, "    Max           %d\n", atomic_load(&shared->max_depth));
+  fprintf(fd, "    Average       %.2f\n", average);
+  if(queue_type == Mutex_Queue) {
+    fprintf(fd, "    Empty         %.3f s (%.1f%%)\n", depth_stats.empty_ns / 1000000000.0,
+        100.0 * depth_stats.empty_ns / elapsed);
+  }
+  fprintf(fd, "    Full          %.3f s (%.1f%%)\n", blocked / 1000000000.0,
+      100.0 * blocked / elapsed);
+}
+
+
+/*
+* Print placement
+*
+* Print the CPU each producer and consumer thread, or fiber worker, was bound to
+*/
+void print_placement() {
+  fprintf(fd, "Placement: %s\n", pin_policy);
+  for(int i=0; i<nproducers; i++) {
+    if(nproducers == 1) {
+      fprintf(fd, "    Producer      %d\n", placement_cpu(i));
+    } else {
+      fprintf(fd, "    Producer %-4d %d\n", i, placement_cpu(i));
+    }
+  }
+  for(int i=0; i<nthreads && nworkers == 0; i++) {
+    evlog_thread_row(fd, i, placement_cpu(nproducers + i));
+  }
+  for(int i=0; i<nworkers; i++) {
+    fprintf(fd, "    Worker  %-6d%d\n", i+1, placement_cpu(nproducers + i));
+  }
+}
+
+
+/*
+* Print counters
+*
+* Print the performance counters of each consumer thread, or of each fiber
+* worker, and their total
+*/
+void print_counters() {
+  int rows = nworkers > 0 ? nworkers : nthreads;
+  uint64_t total[PERFCTR_MAX] = {0};
+  fprintf(fd, "%-18s", "Perf counters:");
+  for(int c=0; c<perfctr_count(); c++) {
+    fprintf(fd, " %14s", perfctr_name(c));
+  }
+  fprintf(fd, "\n");
+  for(int i=0; i<=rows; i++) {
+    uint64_t *values = total;
+    if(i < rows) {
+      values = nworkers > 0 ? worker_perf[i] : thread_stats[i+1].perf;
+      fprintf(fd, nworkers > 0 ? "    Worker  %-6d" : "    Thread  %-6d", i+1);
+    } else {
+      fprintf(fd, "    Total         ");
+    }
+    for(int c=0; c<perfctr_count(); c++) {
+      fprintf(fd, " %14lu", (unsigned long)values[c]);
+      total[c] += (i < rows) ? values[c] : 0;
+    }
+    fprintf(fd, "\n");
+  }
+}
+
+
+/*
+* Print locks
+*
+* Print acquisitions, contended acquisitions, total and longest wait and hold
+* time of each profiled lock per thread that took it, then over all threads.
+* Condition waits count each wait as an acquisition.
+*/
+void print_locks() {
+  static const char *names[LOCK_TYPES] = {"count_mutex", "print_mutex", "empty wait",
+      "full wait"};
+  fprintf(fd, "%-18s %9s %9s %9s %9s %9s\n", "Lock contention:", "acquires", "contended",
+      "wait ms", "max ms", "hold ms");
+  for(int lock=0; lock<LOCK_TYPES; lock++) {
+    lockstat all = {0};
+    for(int i=0; i<nslots; i++) {
+      lockstat_merge(&all, &thread_stats[i].locks[lock]);
+    }
+    if(all.acquires == 0) continue;
+    fprintf(fd, "  %s\n", names[lock]);
+    for(int i=0; i<=nslots; i++) {
+      lockstat *l = &all;
+      if(i < nslots) {
+        l = &thread_stats[i].locks[lock];
+        if(l->acquires == 0) continue;
+        if(i == PRODUCER_ID && nproducers == 1) {
+          fprintf(fd, "    Producer      ");
+        } else if(i == PRODUCER_ID || i > nthreads + 1) {
+          fprintf(fd, "    Producer %-4d ", i == PRODUCER_ID ? 0 : i - nthreads - 1);
+        } else if(i == nthreads + 1) {
+          fprintf(fd, "    Manager       ");
+        } else {
+          fprintf(fd, "    Thread  %-6d", i);
+        }
+      } else {
+        fprintf(fd, "    All           ");
+      }
+      fprintf(fd, " %9ld %9ld %9.3f %9.3f %9.3f\n", l->acquires, l->contended,
+          l->wait_ns / 1000000.0, l->max_wait_ns / 1000000.0, l->hold_ns / 1000000.0);
+    }
   }
-  float total_trans = 0;
+}
+
+
+/*
+* Print processes
+*
+* Print how each consumer process ended, by exit status or by the signal that
+* killed it
+*/
+void print_processes() {
+  fprintf(fd, "Processes:\n");
   for(int i=0; i<nthreads; i++) {
-    total_trans += thread_stats[i];
-    if(i > 998) {
-      fprintf(fd, "    Thread  %d  %d\n", i+1, thread_stats[i]);
-    } else if(i > 98) {
-      fprintf(fd, "    Thread  %d   %d\n", i+1, thread_stats[i]);
-    } else if(i > 8) {
-      fprintf(fd, "    Thread  %d    %d\n", i+1, thread_stats[i]);
+    int status = exit_status[i];
+    if(WIFSIGNALED(status)) {
+      fprintf(fd, "    Thread  %-5d pid %d killed by %s\n", i+1, consumer_pids[i],
+          strsignal(WTERMSIG(status)));
     } else {
-      fprintf(fd, "    Thread  %d     %d\n", i+1, thread_stats[i]);
+      fprintf(fd, "    Thread  %-5d pid %d exited %d\n", i+1, consumer_pids[i],
+          WEXITSTATUS(status));
+    }
+  }
+}
+
+
+/*
+* Consumer exited
+*
+* SIGCHLD handler. Wakes any producer parked on a full ring so that it checks
+* on the consumers; the futex calls behind the eventcount are safe here.
+*/
+void consumer_exited(int sig) {
+  (void)sig;
+  evcount_notify_all(&shared->space_ready);
+}
+
+
+/*
+* Check consumers
+*
+* Called by a producer that finds the ring full while the consumers run as
+* processes. Their state is peeked at without reaping them, so the final
+* waitpid still collects every status. Exits once no consumer is left to make
+* room. Also exits when one has died and nothing is queued yet the ring still
+* has no room after a pause long enough for a live consumer to release the
+* slot it took: the dead consumer claimed a slot and never released it, so
+* the ring can never advance past it. Returns the items pushed on the retry.
+*/
+int check_consumers(work_item *items, int n) {
+  int left = 0;
+  for(int i=0; i<nthreads; i++) {
+    siginfo_t info;
+    info.si_pid = 0;
+    if(waitid(P_PID, consumer_pids[i], &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+        info.si_pid == 0) {
+      left++;
+    }
+  }
+  if(left == nthreads || (left > 0 && lfring_count(&shared->lfqueue) > 0)) {
+    return 0;
+  }
+  if(left > 0) {
+    struct timespec pause = {0, 10000000L};
+    nanosleep(&pause, NULL);
+    int pushed = push_work(PRODUCER_ID, items, n);
+    if(pushed > 0 || lfring_count(&shared->lfqueue) > 0) {
+      return pushed;
     }
+    printf("Error: A consumer process died holding a ring slot\n");
+  } else {
+    printf("Error: Every consumer process has died\n");
+  }
+  for(int i=0; i<nthreads; i++) {
+    kill(consumer_pids[i], SIGKILL);
+  }
+  exit(1);
+}
+
+
+/*
+* Map segment
+*
+* Maps a zeroed shared memory segment of the given size. The name is unlinked
+* straight away, so the segment is only reachable through the mapping that the
+* consumer processes inherit and goes away with the last of them.
+*/
+void * map_segment(size_t bytes) {
+  char name[64];
+  snprintf(name, sizeof(name), "/prodcon.%d", (int)getpid());
+  int shm = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if(shm < 0) {
+    perror("Could not create shared memory");
+    exit(1);
+  }
+  shm_unlink(name);
+  if(ftruncate(shm, bytes) != 0) {
+    perror("Could not size shared memory");
+    exit(1);
+  }
+  void *addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+  if(addr == MAP_FAILED) {
+    perror("Could not map shared memory");
+    exit(1);
   }
-  fprintf(fd, "Transactions per second: %.2f\n", total_trans / current_time);
+  close(shm);
+  return addr;
 }
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "evlog.h"
+#include "sim.h"
+
+static void advance(sim *s, int64_t t);
+static void start(sim *s, int id, work_item item, int64_t t);
+static bool earlier(const sim_busy *a, const sim_busy *b);
+static void busy_push(sim *s, sim_busy b);
+static sim_busy busy_pop(sim *s);
+static void depth_change(sim *s, int depth, int64_t t);
+
+
+void sim_init(sim *s, int nconsumers, int queue_size, int64_t unit_ns, sim_key_fn key,
+        sim_fn record) {
+    s->now = s->end = 0;
+    s->unit_ns = unit_ns;
+    s->nconsumers = nconsumers;
+    pqueue_init(&s->queue, queue_size);
+    s->key = key;
+    s->record = record;
+    s->busy = malloc(sizeof(sim_busy) * nconsumers);
+    s->idle = malloc(sizeof(int) * nconsumers);
+    if(s->busy == NULL || s->idle == NULL) {
+        perror("Simulation allocation failed");
+        exit(1);
+    }
+    s->nbusy = 0;
+    s->idle_head = 0;
+    s->nidle = nconsumers;
+    // Every consumer starts out asking for work
+    for(int i=0; i<nconsumers; i++) {
+        s->idle[i] = i + 1;
+        s->record(Ask, NULL, i + 1, 0);
+    }
+    s->depth = s->max_depth = 0;
+    s->last_ns = s->area = s->empty_ns = s->blocked_ns = 0;
+}
+
+// Hands the item straight to an idle consumer, otherwise queues it, first
+// waiting out completions while the queue is full
+void sim_work(sim *s, work_item item) {
+    advance(s, s->now);
+    while(pqueue_full(&s->queue)) {
+        // A full queue means every consumer is busy, so one finishes next
+        int64_t t = s->busy[0].t;
+        s->blocked_ns += t - s->now;
+        s->now = t;
+        advance(s, t);
+    }
+    item.enq_ns = s->now;
+    s->record(Work, &item, 0, s->now);
+    if(s->nidle > 0) {
+        int id = s->idle[s->idle_head];
+        s->idle_head = (s->idle_head + 1) % s->nconsumers;
+        s->nidle--;
+        start(s, id, item, s->now);
+        return;
+    }
+    pqueue_insert(item, s->key(&item), &s->queue);
+    depth_change(s, s->depth + 1, s->now);
+}
+
+void sim_sleep(sim *s, int64_t ns) {
+    s->now += ns;
+}
+
+// Runs the consumers dry and returns the time of the last event
+int64_t sim_finish(sim *s) {
+    advance(s, INT64_MAX);
+    if(s->now > s->end) s->end = s->now;
+    depth_change(s, s->depth, s->end);
+    return s->end;
+}
+
+void sim_deinit(sim *s) {
+    pqueue_deinit(&s->queue);
+    free(s->busy);
+    free(s->idle);
+}
+
+// Completes every item finishing by t in time order. A consumer that finishes
+// asks again and takes the next queued item, or joins the idle consumers.
+void advance(sim *s, int64_t t) {
+    while(s->nbusy > 0 && s->busy[0].t <= t) {
+        sim_busy b = busy_pop(s);
+        s->record(Complete, &b.item, b.id, b.t);
+        s->record(Ask, NULL, b.id, b.t);
+        if(b.t > s->end) s->end = b.t;
+        work_item item;
+        if(pqueue_remove(&item, &s->queue)) {
+            depth_change(s, s->depth - 1, b.t);
+            start(s, b.id, item, b.t);
+        } else {
+            s->idle[(s->idle_head + s->nidle) % s->nconsumers] = b.id;
+            s->nidle++;
+        }
+    }
+}
+
+void start(sim *s, int id, work_item item, int64_t t) {
+    s->record(Receive, &item, id, t);
+    sim_busy b = {t + (int64_t)item.work * item.count * s->unit_ns, id, item};
+    busy_push(s, b);
+}
+
+// Finish time orders the heap, ties go to the lower consumer id
+bool earlier(const sim_busy *a, const sim_busy *b) {
+    return a->t < b->t || (a->t == b->t && a->id < b->id);
+}
+
+void busy_push(sim *s, sim_busy b) {
+    int i = s->nbusy++;
+    while(i > 0 && earlier(&b, &s->busy[(i - 1) / 2])) {
+        s->busy[i] = s->busy[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    s->busy[i] = b;
+}
+
+sim_busy busy_pop(sim *s) {
+    sim_busy top = s->busy[0];
+    sim_busy last = s->busy[--s->nbusy];
+    int i = 0;
+    while(2 * i + 1 < s->nbusy) {
+        int child = 2 * i + 1;
+        if(child + 1 < s->nbusy && earlier(&s->busy[child + 1], &s->busy[child])) {
+            child++;
+        }
+        if(!earlier(&s->busy[child], &last)) break;
+        s->busy[i] = s->busy[child];
+        i = child;
+    }
+    s->busy[i] = last;
+    return top;
+}
+
+void depth_change(sim *s, int depth, int64_t t) {
+    s->area += s->depth * (t - s->last_ns);
+    if(s->depth == 0) {
+        s->empty_ns += t - s->last_ns;
+    }
+    s->depth = depth;
+    s->last_ns = t;
+    if(depth > s->max_depth) s->max_depth = depth;
+}
@@ -0,0 +1,54 @@
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdint.h>
+
+#include "fifo.h"
+#include "pqueue.h"
+
+/*
+* Discrete-event model of one producer feeding a bounded queue served by a
+* fixed pool of consumers. Time is virtual: the producer's clock moves on with
+* each Sleep and while it waits for space, and a consumer finishes an item
+* work x count x unit_ns after taking it. Events are handed to the record
+* callback as they would be logged, so a trace of any length is modelled in
+* the time it takes to visit its events and nothing is run for real.
+*/
+typedef void (*sim_fn)(int msg, const work_item *item, int id, int64_t t);
+typedef int64_t (*sim_key_fn)(const work_item *item);
+
+typedef struct {
+    int64_t t;
+    int id;
+    work_item item;
+} sim_busy;
+
+typedef struct {
+    int64_t now, end, unit_ns;
+    int nconsumers;
+    // Waiting items ordered by key, equal keys in arrival order
+    pqueue queue;
+    sim_key_fn key;
+    sim_fn record;
+    // Busy consumers as a min-heap on finish time, idle ones longest idle first
+    sim_busy *busy;
+    int nbusy;
+    int *idle;
+    int idle_head, nidle;
+    // Queue occupancy, accounted at every change as for the mutex queue
+    int depth, max_depth;
+    int64_t last_ns, area, empty_ns, blocked_ns;
+} sim;
+
+void sim_init(sim *s, int nconsumers, int queue_size, int64_t unit_ns, sim_key_fn key,
+    sim_fn record);
+
+void sim_work(sim *s, work_item item);
+
+void sim_sleep(sim *s, int64_t ns);
+
+int64_t sim_finish(sim *s);
+
+void sim_deinit(sim *s);
+
+#endif
@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "topology.h"
+
+typedef struct {
+    int cpu, core, package, sibling;
+} topology_cpu;
+
+static int read_online(int *cpus, int max);
+static int parse_list(const char *list, int *cpus, int max);
+static int read_id(int cpu, const char *name);
+static int compare_compact(const void *a, const void *b);
+static int compare_scatter(const void *a, const void *b);
+
+
+// Returns the number of CPUs placed in cpus, or -1 for an invalid list. Only
+// CPUs the process may run on are placed; a list naming any other is invalid.
+int topology_order(const char *policy, int *cpus, int max) {
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        perror("Could not get CPU affinity");
+        exit(1);
+    }
+    bool compact = strcmp(policy, "compact") == 0;
+    if(!compact && strcmp(policy, "scatter") != 0) {
+        int n = parse_list(policy, cpus, max);
+        for(int i=0; i<n; i++) {
+            if(cpus[i] >= CPU_SETSIZE || !CPU_ISSET(cpus[i], &allowed)) return -1;
+        }
+        return n;
+    }
+    int online = read_online(cpus, max);
+    int n = 0;
+    for(int i=0; i<online; i++) {
+        if(cpus[i] < CPU_SETSIZE && CPU_ISSET(cpus[i], &allowed)) cpus[n++] = cpus[i];
+    }
+    topology_cpu *topo = malloc(sizeof(topology_cpu) * n);
+    for(int i=0; i<n; i++) {
+        topo[i].cpu = cpus[i];
+        topo[i].core = read_id(cpus[i], "core_id");
+        topo[i].package = read_id(cpus[i], "physical_package_id");
+        // CPUs are in ascending order, so earlier siblings are already ranked
+        topo[i].sibling = 0;
+        for(int j=0; j<i; j++) {
+            if(topo[j].core == topo[i].core && topo[j].package == topo[i].package) {
+                topo[i].sibling++;
+            }
+        }
+    }
+    qsort(topo, n, sizeof(topology_cpu), compact ? compare_compact : compare_scatter);
+    for(int i=0; i<n; i++) {
+        cpus[i] = topo[i].cpu;
+    }
+    free(topo);
+    return n > 0 ? n : -1;
+}
+
+// Binds the calling thread to one CPU
+bool topology_pin(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+int read_online(int *cpus, int max) {
+    char line[4096];
+    FILE *f = fopen("/sys/devices/system/cpu/online", "r");
+    if(f == NULL || fgets(line, sizeof(line), f) == NULL) {
+        perror("Could not read online CPUs");
+        exit(1);
+    }
+    fclose(f);
+    line[strcspn(line, "\n")] = '\0';
+    return parse_list(line, cpus, max);
+}
+
+// Reads a list of CPUs and ranges in the kernel's cpulist format
+int parse_list(const char *list, int *cpus, int max) {
+    int n = 0;
+    const char *p = list;
+    while(*p != '\0') {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if(end == p || lo < 0) return -1;
+        if(*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if(end == p || hi < lo) return -1;
+        }
+        for(long cpu = lo; cpu <= hi && n < max; cpu++) {
+            cpus[n++] = (int)cpu;
+        }
+        if(*end == ',') {
+            end++;
+        } else if(*end != '\0') {
+            return -1;
+        }
+        p = end;
+    }
+    return n > 0 ? n : -1;
+}
+
+// A missing topology entry reads as -1, which groups such CPUs together
+int read_id(int cpu, const char *name) {
+    char path[128];
+    int id = -1;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    FILE *f = fopen(path, "r");
+    if(f != NULL) {
+        if(fscanf(f, "%d", &id) != 1) id = -1;
+        fclose(f);
+    }
+    return id;
+}
+
+int compare_compact(const void *a, const void *b) {
+    const topology_cpu *x = a, *y = b;
+    if(x->package != y->package) return x->package - y->package;
+    if(x->core != y->core) return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+int compare_scatter(const void *a, const void *b) {
+    const topology_cpu *x = a, *y = b;
+    if(x->sibling != y->sibling) return x->sibling - y->sibling;
+    if(x->core != y->core) return x->core - y->core;
+    if(x->package != y->package) return x->package - y->package;
+    return x->cpu - y->cpu;
+}
@@ -0,0 +1,21 @@
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#include <stdbool.h>
+
+#define TOPOLOGY_MAX_CPUS 1024
+
+/*
+* CPU placement from the sysfs topology of the online CPUs. "compact" orders
+* CPUs so SMT siblings of one core come together and cores of one package
+* before the next package. "scatter" takes the first sibling of every core,
+* alternating packages, before any second sibling. Anything else is read as
+* an explicit list of CPUs such as "0,2,4-7". Only CPUs in the process's
+* affinity mask are placed. Thread k of a placement runs on the k-th CPU of
+* the order, wrapping around when there are more threads.
+*/
+int topology_order(const char *policy, int *cpus, int max);
+
+bool topology_pin(int cpu);
+
+#endif
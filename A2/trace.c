@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+static void begin_event(trace *t);
+static void end_event(trace *t);
+
+
+void trace_open(trace *t, const char *filename, int64_t start_ns) {
+    if((t->fd = fopen(filename, "w")) == NULL) {
+        perror("Could not open trace file");
+        exit(1);
+    }
+    if(pthread_mutex_init(&t->mutex, NULL) != 0) {
+        perror("Mutex init error");
+        exit(1);
+    }
+    t->start_ns = start_ns;
+    t->first = true;
+    fprintf(t->fd, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+}
+
+// Names a track; tracks are sorted by their id
+void trace_track(trace *t, int tid, const char *name) {
+    begin_event(t);
+    fprintf(t->fd, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+        "\"args\": {\"name\": \"%s\"}}", tid, name);
+    end_event(t);
+}
+
+void trace_slice(trace *t, int tid, const char *name, int64_t begin, int64_t end, int val) {
+    begin_event(t);
+    fprintf(t->fd, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+        "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"value\": %d}}", name, tid,
+        (begin - t->start_ns) / 1000.0, (end - begin) / 1000.0, val);
+    end_event(t);
+}
+
+void trace_counter(trace *t, const char *name, int64_t ns, int val) {
+    begin_event(t);
+    fprintf(t->fd, "{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.3f, "
+        "\"args\": {\"value\": %d}}", name, (ns - t->start_ns) / 1000.0, val);
+    end_event(t);
+}
+
+void trace_close(trace *t) {
+    fprintf(t->fd, "\n]}\n");
+    if(fclose(t->fd) != 0) {
+        perror("Could not close trace file");
+        exit(1);
+    }
+    pthread_mutex_destroy(&t->mutex);
+}
+
+// Takes the mutex and separates the event from the one before it
+void begin_event(trace *t) {
+    if(pthread_mutex_lock(&t->mutex) != 0) {
+        perror("Mutex lock error");
+        exit(1);
+    }
+    fprintf(t->fd, t->first ? "\n" : ",\n");
+    t->first = false;
+}
+
+void end_event(trace *t) {
+    if(pthread_mutex_unlock(&t->mutex) != 0) {
+        perror("Mutex unlock error");
+        exit(1);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+* Trace Event Format writer, for loading a run into chrome://tracing or
+* Perfetto. Each track is a thread id of one process; slices are complete
+* ("X") events and counters are ("C") events. Writers on any thread are
+* serialized by the trace's own mutex. Times are nanoseconds on the
+* CLOCK_MONOTONIC scale, written relative to start_ns in microseconds.
+*/
+typedef struct {
+    FILE *fd;
+    pthread_mutex_t mutex;
+    int64_t start_ns;
+    bool first;
+} trace;
+
+void trace_open(trace *t, const char *filename, int64_t start_ns);
+
+void trace_track(trace *t, int tid, const char *name);
+
+void trace_slice(trace *t, int tid, const char *name, int64_t begin, int64_t end, int val);
+
+void trace_counter(trace *t, const char *name, int64_t ns, int val);
+
+void trace_close(trace *t);
+
+#endif
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <unistd.h>
+
+/* User defines */
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define SLEEP_MAX 99
+
+/* Private function prototypes */
+static int uniform(int lo, int hi);
+static int bimodal();
+static int heavy_tailed();
+
+/* Private global variables */
+static int work_max = 0;
+static int large_percent = 10;
+static double alpha = 1.5;
+enum shape {Uniform_Trace, Bimodal_Trace, Heavy_Trace, Bursty_Trace};
+
+
+/*
+* Main program
+*
+* Writes a synthetic prodcon input of T and S commands to stdout. Items are
+* generated one at a time, so traces of any length stream in constant memory.
+*/
+int main(int argc, char *argv[]) {
+  enum shape shape = Uniform_Trace;
+  long count = 1000;
+  long seed = 1;
+  int burst = 50;
+  int sleep = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "d:n:m:p:a:b:s:r:")) != -1) {
+    switch(opt) {
+    case 'd':
+      if(strcmp(optarg, "uniform") == 0) {
+        shape = Uniform_Trace;
+      } else if(strcmp(optarg, "bimodal") == 0) {
+        shape = Bimodal_Trace;
+      } else if(strcmp(optarg, "heavy") == 0) {
+        shape = Heavy_Trace;
+      } else if(strcmp(optarg, "bursty") == 0) {
+        shape = Bursty_Trace;
+      } else {
+        printf("Error: Invalid distribution provided\n");
+        exit(1);
+      }
+      break;
+    case 'n':
+      if((count = atol(optarg)) < 1) {
+        printf("Error: Invalid item count provided\n");
+        exit(1);
+      }
+      break;
+    case 'm':
+      if((work_max = atoi(optarg)) < 1) {
+        printf("Error: Invalid maximum work provided\n");
+        exit(1);
+      }
+      break;
+    case 'p':
+      if((large_percent = atoi(optarg)) < 0 || large_percent > 100) {
+        printf("Error: Invalid percentage provided\n");
+        exit(1);
+      }
+      break;
+    case 'a':
+      if((alpha = atof(optarg)) <= 0) {
+        printf("Error: Invalid tail index provided\n");
+        exit(1);
+      }
+      break;
+    case 'b':
+      if((burst = atoi(optarg)) < 1) {
+        printf("Error: Invalid burst length provided\n");
+        exit(1);
+      }
+      break;
+    case 's':
+      if((sleep = atoi(optarg)) < 0 || sleep > SLEEP_MAX) {
+        printf("Error: Invalid sleep provided\n");
+        exit(1);
+      }
+      break;
+    case 'r':
+      seed = atol(optarg);
+      break;
+    default:
+      printf("Usage: prodcon-gen [-d uniform|bimodal|heavy|bursty] [-n count] [-m max] [-p percent] [-a alpha] [-b burst] [-s sleep] [-r seed]\n");
+      exit(1);
+    }
+  }
+  if(work_max == 0) {
+    work_max = (shape == Heavy_Trace) ? 100 : (shape == Bimodal_Trace) ? 50 : 10;
+  }
+  if(shape == Bursty_Trace && sleep == 0) {
+    sleep = 50;
+  }
+  srand48(seed);
+  setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+  for(long i=0; i<count; i++) {
+    int n;
+    if(shape == Bimodal_Trace) {
+      n = bimodal();
+    } else if(shape == Heavy_Trace) {
+      n = heavy_tailed();
+    } else {
+      n = uniform(1, work_max);
+    }
+    // Bursty traces pause for a random time between bursts of uniform work.
+    // The other shapes only pause when a sleep is given.
+    if(sleep > 0 && i > 0 && i % burst == 0) {
+      if(shape == Bursty_Trace) {
+        printf("S%d\n", uniform(sleep / 2 > 0 ? sleep / 2 : 1, sleep));
+      } else {
+        printf("S%d\n", sleep);
+      }
+    }
+    printf("T%d\n", n);
+  }
+  if(fflush(stdout) != 0) {
+    perror("Write failed");
+    exit(1);
+  }
+  return 0;
+}
+
+
+/*
+* Uniform
+*
+* Returns an integer drawn uniformly from lo to hi inclusive
+*/
+int uniform(int lo, int hi) {
+  return lo + (int)(drand48() * (hi - lo + 1));
+}
+
+
+/*
+* Bimodal
+*
+* Mostly one or two units, with large_percent of items near work_max
+*/
+int bimodal() {
+  if(drand48() * 100 < large_percent) {
+    return uniform(work_max - work_max / 5 > 0 ? work_max - work_max / 5 : 1, work_max);
+  }
+  return uniform(1, 2);
+}
+
+
+/*
+* Heavy tailed
+*
+* Pareto distributed work with minimum 1 and tail index alpha, capped at
+* work_max. Smaller alpha gives a heavier tail.
+*/
+int heavy_tailed() {
+  double n = floor(1.0 / pow(1.0 - drand48(), 1.0 / alpha));
+  return (n > work_max) ? work_max : (int)n;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "wsdeque.h"
+
+// Chase-Lev deque with C11 atomics after Le, Pop, Cohen and Zappa Nardelli
+// https://fzn.fr/readings/ppopp13.pdf
+
+
+void wsdeque_init(wsdeque *d, int size) {
+    long capacity = 2;
+    while(capacity < size) {
+        capacity <<= 1;
+    }
+    d->mask = capacity - 1;
+    d->entries = malloc(sizeof(work_item) * capacity);
+    if(d->entries == NULL) {
+        perror("Deque allocation failed");
+        exit(1);
+    }
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+}
+
+void wsdeque_deinit(wsdeque *d) {
+    free(d->entries);
+}
+
+// Pushes up to n entries at the bottom and publishes them with one store
+int wsdeque_push(const work_item *entries, int n, wsdeque *d) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    long room = d->mask + 1 - (b - t);
+    if(n > room) n = room;
+    for(int i=0; i<n; i++) {
+        d->entries[(b + i) & d->mask] = entries[i];
+    }
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + n, memory_order_relaxed);
+    return n;
+}
+
+// Takes up to max entries from the top with one CAS. The entries are copied out
+// before the CAS; if the owner wrapped around and overwrote them in the meantime
+// top has moved too, the CAS fails and the copies are discarded.
+int wsdeque_steal(work_item *entries, int max, wsdeque *d) {
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    while(true) {
+        atomic_thread_fence(memory_order_seq_cst);
+        long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+        if(t >= b) return 0;
+        int n = (b - t < max) ? (int)(b - t) : max;
+        for(int i=0; i<n; i++) {
+            entries[i] = d->entries[(t + i) & d->mask];
+        }
+        // On failure t is reloaded with the current top and the steal is retried
+        if(atomic_compare_exchange_strong_explicit(&d->top, &t, t + n,
+                memory_order_seq_cst, memory_order_relaxed)) {
+            return n;
+        }
+    }
+}
+
+// Free entries as seen by the owner. Thieves only take, so at least this many
+// can be pushed until the owner pushes again.
+int wsdeque_room(wsdeque *d) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    return (int)(d->mask + 1 - (b - t));
+}
+
+int wsdeque_count(wsdeque *d) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    return (b > t) ? (int)(b - t) : 0;
+}
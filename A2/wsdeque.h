@@ -0,0 +1,32 @@
+#ifndef __WSDEQUE_H__
+#define __WSDEQUE_H__
+
+#include <stdatomic.h>
+
+#include "lfring.h"
+
+/*
+* Bounded Chase-Lev work-stealing deque. A single owner pushes at the bottom
+* and any number of threads take from the top. Capacity is rounded up to a
+* power of two so indices can be masked.
+*/
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_long top;
+    _Alignas(CACHE_LINE) atomic_long bottom;
+    _Alignas(CACHE_LINE) work_item *entries;
+    long mask;
+} wsdeque;
+
+void wsdeque_init(wsdeque *d, int size);
+
+void wsdeque_deinit(wsdeque *d);
+
+int wsdeque_push(const work_item *entries, int n, wsdeque *d);
+
+int wsdeque_room(wsdeque *d);
+
+int wsdeque_steal(work_item *entries, int max, wsdeque *d);
+
+int wsdeque_count(wsdeque *d);
+
+#endif
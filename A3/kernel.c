@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "kernel.h"
+#include "tands.h"
+
+#define CALIBRATE_RUNS 5
+#define HASH_BYTES (16 * 1024)
+#define SORT_COUNT 256
+#define STREAM_BYTES (64 * 1024 * 1024)
+#define STREAM_CHUNK (64 * 1024)
+
+static void trans_step();
+static void hash_step();
+static void sort_step();
+static void stream_step();
+static int compare_int(const void *a, const void *b);
+static void *alloc_random(size_t bytes);
+static int64_t time_step(void (*step)(void));
+static int64_t now_ns();
+
+static kernel kernels[] = {
+    {"trans", trans_step, 0, 0},
+    {"hash", hash_step, 0, 0},
+    {"sort", sort_step, 0, 0},
+    {"stream", stream_step, 0, 0},
+};
+
+// Inputs are shared and only read once filled. Results go to sink so the
+// compiler cannot drop the work.
+static unsigned char *hash_input;
+static int *sort_input;
+static uint64_t *stream_input;
+static atomic_uint_fast64_t sink;
+static _Thread_local int sort_array[SORT_COUNT];
+static _Thread_local size_t stream_offset;
+
+
+// Returns NULL when no kernel has the name
+kernel *kernel_find(const char *name) {
+    kernel *k = NULL;
+    for(size_t i=0; i<sizeof(kernels) / sizeof(kernel); i++) {
+        if(strcmp(kernels[i].name, name) == 0) k = &kernels[i];
+    }
+    if(k == NULL || k->reps > 0) return k;
+    if(k->step == hash_step) {
+        hash_input = alloc_random(HASH_BYTES);
+    } else if(k->step == sort_step) {
+        sort_input = alloc_random(sizeof(int) * SORT_COUNT);
+    } else if(k->step == stream_step) {
+        stream_input = alloc_random(STREAM_BYTES);
+    }
+    // A step of Trans is one unit, the others repeat to match it
+    int64_t trans_ns = time_step(trans_step);
+    int64_t step_ns = time_step(k->step);
+    k->reps = (k->step == trans_step) ? 1 : (int)((trans_ns + step_ns / 2) / step_ns);
+    if(k->reps < 1) k->reps = 1;
+    k->unit_ns = (k->step == trans_step) ? trans_ns : step_ns * k->reps;
+    return k;
+}
+
+void kernel_run(const kernel *k, int n) {
+    if(k->step == trans_step) {
+        Trans(n);
+        return;
+    }
+    for(long i=0; i<(long)n * k->reps; i++) {
+        k->step();
+    }
+}
+
+void trans_step() {
+    Trans(1);
+}
+
+void hash_step() {
+    uint64_t h = 14695981039346656037ULL;
+    for(int i=0; i<HASH_BYTES; i++) {
+        h = (h ^ hash_input[i]) * 1099511628211ULL;
+    }
+    atomic_store_explicit(&sink, h, memory_order_relaxed);
+}
+
+void sort_step() {
+    memcpy(sort_array, sort_input, sizeof(sort_array));
+    qsort(sort_array, SORT_COUNT, sizeof(int), compare_int);
+    atomic_store_explicit(&sink, sort_array[SORT_COUNT / 2], memory_order_relaxed);
+}
+
+// Each thread walks the buffer a chunk per step, so consecutive steps miss in
+// cache instead of rereading the chunk just loaded
+void stream_step() {
+    const uint64_t *chunk = stream_input + stream_offset / sizeof(uint64_t);
+    uint64_t sum = 0;
+    for(size_t i=0; i<STREAM_CHUNK / sizeof(uint64_t); i++) {
+        sum += chunk[i];
+    }
+    stream_offset = (stream_offset + STREAM_CHUNK) % STREAM_BYTES;
+    atomic_store_explicit(&sink, sum, memory_order_relaxed);
+}
+
+int compare_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Filled with xorshift64 before any thread reads the buffer
+void *alloc_random(size_t bytes) {
+    uint64_t *buf = malloc(bytes);
+    if(buf == NULL) {
+        perror("Kernel allocation failed");
+        exit(1);
+    }
+    uint64_t x = 88172645463325252ULL;
+    for(size_t i=0; i<bytes / sizeof(uint64_t); i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buf[i] = x;
+    }
+    return buf;
+}
+
+// Fastest of a few runs after a warm-up run
+int64_t time_step(void (*step)(void)) {
+    int64_t best = INT64_MAX;
+    step();
+    for(int i=0; i<CALIBRATE_RUNS; i++) {
+        int64_t begin = now_ns();
+        step();
+        int64_t elapsed = now_ns() - begin;
+        if(elapsed < best) best = elapsed;
+    }
+    return best > 0 ? best : 1;
+}
+
+int64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
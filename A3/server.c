@@ -13,6 +13,7 @@
 
 /* User defined headers */
 #include "fifo.h"
+#include "kernel.h"
 #include "tands.h"
 
 /* User defines */
@@ -47,6 +48,7 @@ static client clients[FD_MAX*2];
 static int client_ids[FD_MAX];
 static int port;
 static int client_count = 0;
+static kernel *work_kernel;
 
 /* Private function prototypes */
 static void * thread_function(void *arg);
@@ -159,7 +161,7 @@ static void * thread_function(void *arg) {
 */
 static void connection_handler(transaction* t) {
     /* Executing transaction */
-    Trans(t->work);
+    kernel_run(work_kernel, t->work);
     // Create Done message to send to client
     char done_message[12];
     int pos = 0;
@@ -177,10 +179,12 @@ static void connection_handler(transaction* t) {
 
 /*
 * Check command line arguments for correct format
+*
+* An optional second argument selects the transaction kernel, Trans by default
 */
 static void usage_check(int argc, char* argv[]) {
     // Usage check
-    if(argc != 2) {
+    if(argc != 2 && argc != 3) {
         printf("Error: Invalid number of arguments");
         exit(EXIT_FAILURE);
     }
@@ -188,6 +192,10 @@ static void usage_check(int argc, char* argv[]) {
         printf("Error: port number is not a valid number");
         exit(EXIT_FAILURE);
     }
+    if((work_kernel = kernel_find(argc == 3 ? argv[2] : "trans")) == NULL) {
+        printf("Error: kernel is not one of trans, hash, sort or stream");
+        exit(EXIT_FAILURE);
+    }
 }
 
 